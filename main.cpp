@@ -11,8 +11,38 @@
     - Configurable buffer sizes and iteration counts
     - Direction control: --direction host2dev | dev2host | both
     - Output unit: --unit mb | gb (default is gb)
+    - Completion wait strategy: --wait block | finish | events | poll | callback | all
     - Real-time progress display
     - Clean summary output: min / avg / max bandwidth
+    - Latency percentiles, device execution time and host CPU time per transfer
+    - Host CPU cost accounting: process/thread CPU time per transfer and per GB,
+      voluntary/involuntary context switches
+    - Hardware/software counters of the submitting thread via perf_event_open
+      (--perf, Linux only)
+    - Long-stall detector with /proc system context snapshots (--stall-factor)
+    - Periodicity analysis of per-iteration timings via FFT/autocorrelation (--periodicity)
+    - Soak mode (--duration) with per-second time series, throttling detection
+      and a per-transfer watchdog (--timeout)
+    - Online CUSUM change-point detection of bandwidth level shifts (--changepoints)
+    - Background hwmon (GPU temperature/power/fan) and cpufreq sampling aligned
+      with transfers (--sensors, Linux only)
+    - Energy per GB from RAPL powercap and GPU hwmon energy/power sensors (--energy, Linux only)
+    - PCIe link health per size: AER error deltas and link speed/width changes (Linux only)
+    - Link efficiency against theoretical PCIe bandwidth (encoding and TLP overhead)
+    - PCIe topology map and multi-GPU contention per shared uplink
+    - Environment fingerprint with warnings for distorting settings (--strict refuses to run)
+    - Stabilization mode with RT scheduling, mlockall and CPU isolation (Linux)
+    - Timer calibration selecting the cheapest reliable clock for transfer timing
+    - Harness noise floor (marker, idle clFinish, 1-byte transfers), optionally subtracted
+    - Host memory-bandwidth interference generator with PCIe bandwidth per load level
+    - Data patterns (zeros, constant, sequential, random) filled in parallel on host and device
+    - End-to-end data verification with CRC32C (SSE4.2 / ARMv8 CRC / software)
+    - Alignment and odd-size sweep (host pointer alignment, device offset, size + 1)
+    - CPU store/load bandwidth into mapped device buffers (regular and non-temporal SIMD)
+    - Host memory budget planner (meminfo, memlock, cgroup) with peak RSS and pinned report
+    - Machine-readable JSON/CSV summary with a versioned schema (--format, --output)
+    - Crash-safe delta-encoded binary per-sample log (--samples) and CSV converter
+    - Chrome/Perfetto trace of enqueue calls, waits and device execution (--trace)
     - CPU and GPU name output (GPU name with memory in MB)
     - GPU memory size aware buffer size filtering for standard sizes
     - Version info via --version
@@ -37,6 +67,7 @@
   } while (0)
 
 #include <CL/cl.h>
+#include <CL/cl_ext.h>
 #include <chrono>
 #include <iostream>
 #include <vector>
@@ -47,12 +78,80 @@
 #include <string>
 #include <algorithm>
 #include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <cmath>
+#include <complex>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <ctime>
 
 #ifdef _WIN32
 #include <windows.h>
 #include <intrin.h> // __cpuid
 #else
-#include <fstream>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define HAVE_TSC 1
+#if !defined(_WIN32)
+#include <x86intrin.h>  // __rdtsc
+#include <cpuid.h>
+#endif
+#include <nmmintrin.h>  // _mm_crc32_*
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#define HAVE_ARM_CRC 1
+#include <arm_acle.h>   // __crc32c*
+#include <asm/hwcap.h>  // HWCAP_CRC32
+#include <sys/auxv.h>   // getauxval
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <dirent.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef CL_DEVICE_PCI_BUS_INFO_KHR
+#define CL_DEVICE_PCI_BUS_INFO_KHR 0x410F
+typedef struct _cl_device_pci_bus_info_khr {
+  cl_uint pci_domain;
+  cl_uint pci_bus;
+  cl_uint pci_device;
+  cl_uint pci_function;
+} cl_device_pci_bus_info_khr;
+#endif
+
+#ifndef CL_DEVICE_TOPOLOGY_AMD
+#define CL_DEVICE_TOPOLOGY_AMD 0x4037
+#endif
+#define CL_DEVICE_TOPOLOGY_TYPE_PCIE_AMD_ 1
+typedef union {
+  struct { cl_uint type; cl_uint data[5]; } raw;
+  struct { cl_uint type; cl_char unused[17]; cl_char bus; cl_char device; cl_char function; } pcie;
+} device_topology_amd;
+
+#ifndef CL_DEVICE_PCI_BUS_ID_NV
+#define CL_DEVICE_PCI_BUS_ID_NV 0x4008
+#define CL_DEVICE_PCI_SLOT_ID_NV 0x4009
+#endif
+#ifndef CL_DEVICE_PCI_DOMAIN_ID_NV
+#define CL_DEVICE_PCI_DOMAIN_ID_NV 0x400A
 #endif
 
 #ifdef _WIN32
@@ -99,6 +198,65 @@ enum class Unit {
   GBps
 };
 
+enum class WaitMode {
+  Block,     // blocking enqueue followed by clFinish
+  Finish,    // non-blocking enqueue, clFinish
+  Events,    // non-blocking enqueue, clWaitForEvents
+  Poll,      // non-blocking enqueue, spin on CL_EVENT_COMMAND_EXECUTION_STATUS
+  Callback   // non-blocking enqueue, clSetEventCallback + condition variable
+};
+
+enum class Pattern {
+  Zeros,
+  Constant,    // 0x01 bytes
+  Sequential,  // 64-bit word index
+  Random       // hash of the word index, incompressible
+};
+
+enum class StreamOp {
+  Read,
+  Write,
+  Copy
+};
+
+struct Options {
+  int rounds = 100;
+  Direction direction = Direction::Both;
+  Unit unit = Unit::GBps;
+  std::vector<WaitMode> waitModes = { WaitMode::Block };
+  bool perf = false;
+  double stallFactor = 0;  // 0 disables the stall detector
+  bool periodicity = false;
+  double duration = 0;     // soak mode run time in seconds, 0 = regular benchmark
+  double timeout = 0;      // per-transfer watchdog in seconds, 0 = off
+  bool changePoints = false;
+  bool sensors = false;
+  double sensorRate = 10;  // Hz
+  std::string sysfsRoot = "/sys";
+  bool energy = false;
+  std::string pciDevice;   // overrides the address reported by the OpenCL driver
+  bool topology = false;
+  std::string devices;     // multi-device contention run: "all" or a list of device indices
+  bool strict = false;     // refuse to run when the environment check warns
+  bool stabilize = false;  // RT scheduling, mlockall and CPU isolation around timed passes
+  std::string clock = "auto";  // transfer timer: auto, hrc, steady, raw, tsc
+  bool subtractFloor = false;  // report latencies minus the marker round trip
+  std::vector<int> interference;  // background memory load levels in threads, empty = off
+  StreamOp interferenceOp = StreamOp::Copy;
+  std::string interferencePin = "none";  // none, numa, smt
+  Pattern pattern = Pattern::Constant;
+  bool verify = false;     // CRC32C check of received data after each pass
+  bool verifyAll = false;  // ... and after every timed read
+  bool alignmentSweep = false;
+  bool cpuAccess = false;
+  uint64_t memoryBudget = 0;  // host memory budget in bytes, 0 = 75% of free
+  std::string format = "text";  // text, json or csv
+  std::string output;           // file for the --format output, empty = stdout
+  std::string samples;          // binary per-sample log
+  std::string samplesToCsv;     // convert this sample log and exit
+  std::string trace;            // Chrome trace-event JSON of the transfer timeline
+};
+
 void print_help() {
   std::cout << "gpu-pcie-bench version " << VERSION << "\n"
             << "GPU <-> Host Bandwidth Benchmark via OpenCL\n\n"
@@ -110,6 +268,64 @@ void print_help() {
             << "  --sizes SIZES        Comma-separated buffer sizes with optional units (e.g. 1,10K,100M,1G)\n"
             << "  --direction MODE     Transfer direction: host2dev, dev2host, both (default)\n"
             << "  --unit mb|gb         Output unit (default: gb)\n"
+            << "  --wait MODES         Completion wait strategy: block (default), finish, events, poll,\n"
+            << "                       callback; comma-separated or 'all' to compare them\n"
+            << "  --perf               Collect CPU performance counters per size and direction (Linux)\n"
+            << "  --stall-factor X     Report iterations slower than X times the running median, with\n"
+            << "                       interrupt, load and page fault snapshots (default: off)\n"
+            << "  --periodicity        Report dominant periods in the per-iteration timing jitter\n"
+            << "  --duration TIME      Soak mode: run the first --sizes entry (default 64M) continuously for\n"
+            << "                       TIME (e.g. 90s, 30m, 4h), printing per-second throughput and latency\n"
+            << "  --timeout TIME       Abort if a single transfer takes longer than TIME (default: off,\n"
+            << "                       10s in soak mode)\n"
+            << "  --changepoints       Detect and timestamp bandwidth level shifts (CUSUM)\n"
+            << "  --sensors            Sample GPU hwmon sensors and the submitting core's frequency (Linux)\n"
+            << "  --sensor-rate HZ     Sensor sampling rate (default: 10)\n"
+            << "  --sysfs-root PATH    Read sysfs from PATH instead of /sys (for testing)\n"
+            << "  --energy             Report joules per GB from RAPL and GPU hwmon sensors (Linux, implies\n"
+            << "                       --sensors)\n"
+            << "  --pci-device ADDR    PCI address of the GPU for sysfs link checks (e.g. 0000:03:00.0)\n"
+            << "  --topology           Print the PCIe tree above all GPUs and mark shared uplinks (Linux)\n"
+            << "  --devices LIST       Contention run: measure the listed GPUs (e.g. 0,1 or 'all') alone and\n"
+            << "                       concurrently on the first --sizes entry (default 64M) and compare\n"
+            << "                       with the prediction from shared uplinks\n"
+            << "  --clock NAME         Transfer timer: auto (default: cheapest reliable after calibration),\n"
+            << "                       hrc, steady, raw (CLOCK_MONOTONIC_RAW), tsc\n"
+            << "  --subtract-floor     Also report latency and bandwidth minus the harness noise floor\n"
+            << "                       (marker command round trip with the same wait mode)\n"
+            << "  --pattern P          Data written to host and device buffers: zeros, constant (default),\n"
+            << "                       sequential or random (incompressible)\n"
+            << "  --verify             Check received data with CRC32C after each pass (last timed read and\n"
+            << "                       an untimed round trip); exit code 3 on a mismatch\n"
+            << "  --verify-all         Like --verify, and also check every timed read\n"
+            << "  --alignment-sweep    Instead of the normal run, sweep host pointer alignment (4K, 256, 64,\n"
+            << "                       1 B via USE_HOST_PTR), device offsets (+64, +1) and each size + 1 byte\n"
+            << "                       (default sizes: 4K, 1M, 64M)\n"
+            << "  --cpu-access         Instead of the normal run, measure CPU store/load bandwidth (regular\n"
+            << "                       and non-temporal SIMD) into a mapped device buffer, with and without\n"
+            << "                       ALLOC_HOST_PTR, on the first --sizes entry (default 64M)\n"
+            << "  --memory-budget SIZE Host memory the size loop may use (default: 75% of available memory and\n"
+            << "                       cgroup limit); sizes share one pinned buffer or are skipped to fit\n"
+            << "  --interference N,..  Repeat each size under N background threads streaming through host\n"
+            << "                       memory (e.g. 0,2,4,8) and compare PCIe bandwidth per level\n"
+            << "  --interference-op OP read, write or copy (default)\n"
+            << "  --interference-pin P none (default), numa (GPU's NUMA node) or smt (siblings of the\n"
+            << "                       submitting core, Linux)\n"
+            << "  --stabilize          Low-noise mode: SCHED_FIFO, mlockall, pin to an isolated core, move\n"
+            << "                       other threads away and no progress output; each pass is preceded\n"
+            << "                       by an unstabilized baseline to compare variance (Linux)\n"
+            << "  --format FMT         Output format: text (default), json or csv; json and csv summarize the\n"
+            << "                       size loop with a versioned schema, progress text goes to stderr\n"
+            << "                       (not with --duration, --devices, --alignment-sweep or --cpu-access)\n"
+            << "  --output FILE        Write the --format output to FILE instead of stdout\n"
+            << "  --samples FILE       Record every timed transfer (time, size, direction, wait mode, wall\n"
+            << "                       and device time) to a compact binary log that survives crashes\n"
+            << "                       (on Linux; elsewhere up to the last 1024 records can be lost)\n"
+            << "  --samples-to-csv FILE Convert a --samples log to CSV on stdout (or --output) and exit\n"
+            << "  --trace FILE         Write the transfer timeline (enqueue calls, waits, device execution per\n"
+            << "                       queue) as Chrome trace-event JSON for ui.perfetto.dev or chrome://tracing\n"
+            << "  --strict             Refuse to run when the environment check finds settings known to\n"
+            << "                       distort results (slow governor, busy host)\n"
             << "  --version            Show version info\n"
             << "  --help               Show this help message\n";
 }
@@ -154,6 +370,15 @@ Direction parse_direction(const std::string& s) {
   exit(1);
 }
 
+const char* direction_name(Direction d) {
+  switch (d) {
+    case Direction::HostToDevice: return "host2dev";
+    case Direction::DeviceToHost: return "dev2host";
+    case Direction::Both:         return "both";
+  }
+  return "?";
+}
+
 Unit parse_unit(const std::string& s) {
   std::string lower = s;
   std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
@@ -163,6 +388,102 @@ Unit parse_unit(const std::string& s) {
   exit(1);
 }
 
+// Seconds with an optional ms, s, m or h suffix (e.g. 500ms, 90s, 30m, 4h).
+double parse_duration(const std::string& s) {
+  size_t pos = 0;
+  double value = 0;
+  try {
+    value = std::stod(s, &pos);
+  } catch (...) {
+    pos = 0;
+  }
+  std::string suffix = s.substr(pos);
+  std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+  if (pos == 0 || value < 0) {
+    std::cerr << "Invalid duration: " << s << "\n";
+    exit(1);
+  }
+  if (suffix.empty() || suffix == "s") return value;
+  if (suffix == "ms") return value / 1000;
+  if (suffix == "m")  return value * 60;
+  if (suffix == "h")  return value * 3600;
+  std::cerr << "Invalid duration: " << s << "\n";
+  exit(1);
+}
+
+const char* pattern_name(Pattern p) {
+  switch (p) {
+    case Pattern::Zeros:      return "zeros";
+    case Pattern::Constant:   return "constant";
+    case Pattern::Sequential: return "sequential";
+    case Pattern::Random:     return "random";
+  }
+  return "?";
+}
+
+Pattern parse_pattern(const std::string& s) {
+  for (Pattern p : { Pattern::Zeros, Pattern::Constant, Pattern::Sequential, Pattern::Random }) {
+    if (s == pattern_name(p)) return p;
+  }
+  std::cerr << "Unknown pattern: " << s << "\n";
+  exit(1);
+}
+
+StreamOp parse_stream_op(const std::string& s) {
+  if (s == "read")  return StreamOp::Read;
+  if (s == "write") return StreamOp::Write;
+  if (s == "copy")  return StreamOp::Copy;
+  std::cerr << "Unknown interference operation: " << s << "\n";
+  exit(1);
+}
+
+const char* stream_op_name(StreamOp op) {
+  switch (op) {
+    case StreamOp::Read:  return "read";
+    case StreamOp::Write: return "write";
+    case StreamOp::Copy:  return "copy";
+  }
+  return "?";
+}
+
+const char* wait_mode_name(WaitMode mode) {
+  switch (mode) {
+    case WaitMode::Block:    return "block";
+    case WaitMode::Finish:   return "finish";
+    case WaitMode::Events:   return "events";
+    case WaitMode::Poll:     return "poll";
+    case WaitMode::Callback: return "callback";
+  }
+  return "unknown";
+}
+
+std::vector<WaitMode> parse_wait_modes(const std::string& s) {
+  const WaitMode allModes[] = {
+    WaitMode::Block, WaitMode::Finish, WaitMode::Events, WaitMode::Poll, WaitMode::Callback
+  };
+  std::string lower = s;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  if (lower == "all") return std::vector<WaitMode>(std::begin(allModes), std::end(allModes));
+
+  std::vector<WaitMode> result;
+  std::stringstream ss(lower);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    auto it = std::find_if(std::begin(allModes), std::end(allModes),
+                           [&](WaitMode m) { return item == wait_mode_name(m); });
+    if (it == std::end(allModes)) {
+      std::cerr << "Unknown wait mode: " << item << "\n";
+      exit(1);
+    }
+    result.push_back(*it);
+  }
+  if (result.empty()) {
+    std::cerr << "No wait mode given\n";
+    exit(1);
+  }
+  return result;
+}
+
 void filter_static_sizes_by_gpu_memory(std::vector<size_t>& sizes, size_t gpuMemSize) {
   std::vector<size_t> staticSizes = {
     512 * 1024,
@@ -203,199 +524,4611 @@ std::string format_size(size_t bytes) {
   }
 }
 
-double measure(cl_command_queue queue, cl_mem deviceBuf, void* hostPtr, size_t size, bool write) {
-  auto start = std::chrono::high_resolution_clock::now();
-  cl_int status = write ?
-    clEnqueueWriteBuffer(queue, deviceBuf, CL_TRUE, 0, size, hostPtr, 0, nullptr, nullptr) :
-    clEnqueueReadBuffer(queue, deviceBuf, CL_TRUE, 0, size, hostPtr, 0, nullptr, nullptr);
-  clFinish(queue);
-  CHECK(status, write ? "Write failed" : "Read failed");
-  auto end = std::chrono::high_resolution_clock::now();
-  return std::chrono::duration<double>(end - start).count();
+inline uint64_t splitmix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
 }
 
-int main(int argc, char* argv[]) {
-  int rounds = 100;
-  int targetDevice = 0;
-  Direction direction = Direction::Both;
-  Unit unit = Unit::GBps;
-  bool userSpecifiedSizes = false;
+// 64-bit word number `index` of a pattern. Random words are a hash of the
+// index, so any range of the buffer can be generated (or regenerated for
+// checking) independently of the rest.
+inline uint64_t pattern_word(Pattern pattern, uint64_t index) {
+  switch (pattern) {
+    case Pattern::Zeros:      return 0;
+    case Pattern::Constant:   return 0x0101010101010101ULL;
+    case Pattern::Sequential: return index;
+    case Pattern::Random:     return splitmix64(index);
+  }
+  return 0;
+}
 
-  std::vector<size_t> sizes = {
-    512 * 1024,
-    1 * 1024 * 1024,
-    10 * 1024 * 1024,
-    100 * 1024 * 1024,
-    512 * 1024 * 1024,
-  };
+// Fills a buffer with a pattern, split over the hardware threads so that
+// multi-GB buffers don't dominate startup.
+void fill_pattern(void* buffer, size_t size, Pattern pattern) {
+  unsigned char* bytes = static_cast<unsigned char*>(buffer);
+  size_t words = size / sizeof(uint64_t);
+  size_t threadCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+                                                            size / (16 * 1024 * 1024) + 1));
+  size_t perThread = (words + threadCount - 1) / threadCount;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < threadCount; ++t) {
+    size_t first = t * perThread, last = std::min(words, first + perThread);
+    if (first >= last) break;
+    threads.emplace_back([=] {
+      for (size_t i = first; i < last; ++i) {
+        uint64_t word = pattern_word(pattern, i);
+        memcpy(bytes + i * sizeof(uint64_t), &word, sizeof(word));
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  uint64_t tail = pattern_word(pattern, words);
+  memcpy(bytes + words * sizeof(uint64_t), &tail, size % sizeof(uint64_t));
+}
 
-#if UINTPTR_MAX == 0xffffffffffffffff
-  sizes.push_back(1024ULL * 1024 * 1024);   // 1 GB
-  sizes.push_back(2048ULL * 1024 * 1024);   // 2 GB
-  sizes.push_back(4096ULL * 1024 * 1024);   // 4 GB
-#endif
+// CPU time and scheduling counters, snapshotted around every measured
+// transfer. Process time includes driver threads (e.g. the one delivering
+// event callbacks), thread time only the submitting thread.
+struct CpuUsage {
+  double process = 0;        // user + system seconds
+  double thread = 0;
+  double voluntary = 0;      // context switches, whole process
+  double involuntary = 0;
 
-  for (int i = 1; i < argc; ++i) {
-    std::string arg = argv[i];
-    if (arg == "--help") {
-      print_help();
-      return 0;
-    } else if (arg == "--version") {
-      std::cout << "gpu-pcie-bench version " << VERSION << "\n";
-      return 0;
-    } else if (arg == "--rounds" && i + 1 < argc) {
-      rounds = std::stoi(argv[++i]);
-    } else if (arg == "--sizes" && i + 1 < argc) {
-      sizes = parse_sizes(argv[++i]);
-      userSpecifiedSizes = true;
-    } else if (arg == "--direction" && i + 1 < argc) {
-      direction = parse_direction(argv[++i]);
-    } else if (arg == "--unit" && i + 1 < argc) {
-      unit = parse_unit(argv[++i]);
-    } else if (arg == "--device" && i + 1 < argc) {
-      targetDevice = std::stoi(argv[++i]);
-    } else {
-      std::cerr << "Unknown argument: " << arg << "\n";
-      print_help();
-      return 1;
-    }
+  CpuUsage& operator+=(const CpuUsage& o) {
+    process += o.process;
+    thread += o.thread;
+    voluntary += o.voluntary;
+    involuntary += o.involuntary;
+    return *this;
   }
 
-  // CPU Name
-  std::cout << "CPU: " << get_cpu_name() << "\n";
+  CpuUsage operator-(const CpuUsage& o) const {
+    CpuUsage d;
+    d.process = process - o.process;
+    d.thread = thread - o.thread;
+    d.voluntary = voluntary - o.voluntary;
+    d.involuntary = involuntary - o.involuntary;
+    return d;
+  }
+};
 
-  cl_int status;
-  cl_uint numPlatforms = 0;
-  CHECK(clGetPlatformIDs(0, nullptr, &numPlatforms), "Failed to get platform count");
-  if (numPlatforms == 0) {
-    std::cerr << "No OpenCL platforms found.\n";
-    return 1;
+#ifdef _WIN32
+CpuUsage cpu_usage_now() {
+  auto toSeconds = [](const FILETIME& ft) {
+    return ((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) * 1e-7;
+  };
+  CpuUsage usage;
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if (GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+    usage.process = toSeconds(kernelTime) + toSeconds(userTime);
   }
-  std::vector<cl_platform_id> platforms(numPlatforms);
-  CHECK(clGetPlatformIDs(numPlatforms, platforms.data(), nullptr), "Failed to get platforms");
+  if (GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+    usage.thread = toSeconds(kernelTime) + toSeconds(userTime);
+  }
+  // Context switch counts are not exposed without the performance counter API.
+  return usage;
+}
+#else
+CpuUsage cpu_usage_now() {
+  CpuUsage usage;
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    usage.process = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+                    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+    usage.voluntary = static_cast<double>(ru.ru_nvcsw);
+    usage.involuntary = static_cast<double>(ru.ru_nivcsw);
+  }
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+    usage.thread = ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+  return usage;
+}
+#endif
 
-  cl_platform_id platform = platforms[0];
-  cl_uint numDevices = 0;
-  CHECK(clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 0, nullptr, &numDevices), "Failed to get device count");
-  if (numDevices == 0) {
-    std::cerr << "No GPU devices found on platform.\n";
-    return 1;
+enum PerfCounterId {
+  PerfCycles,
+  PerfInstructions,
+  PerfLLCMisses,
+  PerfDTLBMisses,
+  PerfPageFaults,
+  PerfContextSwitches,
+  PerfCounterCount
+};
+
+const char* const perfCounterNames[PerfCounterCount] = {
+  "cycles", "instructions", "LLC misses", "dTLB misses", "page faults", "context switches"
+};
+
+struct PerfCounts {
+  double value[PerfCounterCount] = {};
+
+  PerfCounts& operator+=(const PerfCounts& o) {
+    for (int i = 0; i < PerfCounterCount; ++i) value[i] += o.value[i];
+    return *this;
   }
-  std::vector<cl_device_id> devices(numDevices);
-  CHECK(clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, numDevices, devices.data(), nullptr), "Failed to get devices");
+};
 
-  if (targetDevice >= numDevices) {
-    std::cerr << "Target GPU device " << targetDevice << " is beyond GPU devices found on platform.\n";
-    return 1;
+// Counters of the submitting thread, enabled only while a transfer is in
+// flight. Each counter is opened on its own so that a PMU lacking one event
+// (common in VMs) does not take the others down with it.
+struct PerfSession {
+  int fd[PerfCounterCount] = { -1, -1, -1, -1, -1, -1 };
+  bool userOnly = false;
+
+  bool available() const {
+    for (int f : fd) if (f >= 0) return true;
+    return false;
   }
 
-  cl_device_id device = devices[targetDevice];
+  bool has(int id) const { return fd[id] >= 0; }
 
-  // GPU Name
-  size_t gpuNameSize = 0;
-  CHECK(clGetDeviceInfo(device, CL_DEVICE_NAME, 0, nullptr, &gpuNameSize), "Failed to get GPU name size");
-  std::vector<char> gpuName(gpuNameSize);
-  CHECK(clGetDeviceInfo(device, CL_DEVICE_NAME, gpuNameSize, gpuName.data(), nullptr), "Failed to get GPU name");
+#ifdef __linux__
+  static int open_counter(uint32_t type, uint64_t config, bool excludeKernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = excludeKernel ? 1 : 0;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
 
-  cl_ulong gpuMemSize = 0;
-  CHECK(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(gpuMemSize), &gpuMemSize, nullptr), "Failed to get GPU memory size");
+  void open() {
+    const struct { uint32_t type; uint64_t config; } events[PerfCounterCount] = {
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+      { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+      { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    };
 
-  std::cout << "GPU: " << std::string(gpuName.data()) << " (" << (gpuMemSize / (1024 * 1024)) << " MB)\n";
+    int lastErrno = 0;
+    for (int i = 0; i < PerfCounterCount; ++i) {
+      fd[i] = open_counter(events[i].type, events[i].config, userOnly);
+      if (fd[i] < 0 && !userOnly && (errno == EACCES || errno == EPERM)) {
+        // perf_event_paranoid >= 2 forbids kernel-side counting; fall back to
+        // user space for all counters so they stay comparable.
+        close();
+        userOnly = true;
+        i = -1;
+        continue;
+      }
+      if (fd[i] < 0) lastErrno = errno;
+    }
 
-  if (!userSpecifiedSizes) {
-    filter_static_sizes_by_gpu_memory(sizes, static_cast<size_t>(gpuMemSize));
+    if (!available()) {
+      std::string paranoid = "unknown";
+      std::ifstream f("/proc/sys/kernel/perf_event_paranoid");
+      std::getline(f, paranoid);
+      std::cerr << "Warning: perf counters unavailable (" << strerror(lastErrno)
+                << ", perf_event_paranoid=" << paranoid << "), continuing without them\n";
+      return;
+    }
+    for (int i = 0; i < PerfCounterCount; ++i) {
+      if (fd[i] < 0) std::cerr << "Warning: perf counter '" << perfCounterNames[i] << "' unavailable\n";
+    }
+    if (userOnly) std::cerr << "Note: perf counters restricted to user space by perf_event_paranoid\n";
   }
 
-  if (sizes.empty()) {
-    std::cerr << "No buffer sizes fit GPU memory constraints. Exiting.\n";
-    return 1;
+  void close() {
+    for (int& f : fd) {
+      if (f >= 0) ::close(f);
+      f = -1;
+    }
   }
 
-  cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &status);
-  CHECK(status, "Failed to create context");
+  void begin() {
+    for (int f : fd) {
+      if (f < 0) continue;
+      ioctl(f, PERF_EVENT_IOC_RESET, 0);
+      ioctl(f, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
 
-  cl_command_queue queue = clCreateCommandQueue(context, device, 0, &status);
-  CHECK(status, "Failed to create command queue");
+  void end(PerfCounts& counts) {
+    for (int f : fd) if (f >= 0) ioctl(f, PERF_EVENT_IOC_DISABLE, 0);
+    for (int i = 0; i < PerfCounterCount; ++i) {
+      if (fd[i] < 0) continue;
+      uint64_t data[3] = {};  // value, time enabled, time running
+      if (read(fd[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+      // Scale up if the PMU was multiplexed between counters.
+      counts.value[i] += static_cast<double>(data[0]) * data[1] / data[2];
+    }
+  }
+#else
+  void open() {
+    std::cerr << "Warning: perf counters are only supported on Linux\n";
+  }
+  void close() {}
+  void begin() {}
+  void end(PerfCounts&) {}
+#endif
+};
 
-  std::cout << std::fixed << std::setprecision(2);
+// Seconds since the first call, used to timestamp samples and events.
+double elapsed_seconds() {
+  static const auto epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+}
 
-  for (size_t dataSize : sizes) {
-    std::cout << "\n[Buffer size: " << format_size(dataSize) << "]\n";
+enum class ClockSource {
+  HighResolution,  // std::chrono::high_resolution_clock
+  Steady,          // std::chrono::steady_clock
+  MonotonicRaw,    // clock_gettime(CLOCK_MONOTONIC_RAW), Linux
+  Tsc              // invariant time stamp counter, x86
+};
 
-    cl_mem hostBuf = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, dataSize, nullptr, &status);
-    CHECK(status, "Failed to allocate pinned host buffer");
+const char* clock_source_name(ClockSource c) {
+  switch (c) {
+    case ClockSource::HighResolution: return "high_resolution_clock";
+    case ClockSource::Steady:         return "steady_clock";
+    case ClockSource::MonotonicRaw:   return "CLOCK_MONOTONIC_RAW";
+    case ClockSource::Tsc:            return "TSC";
+  }
+  return "?";
+}
 
-    cl_mem recvBuf = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, dataSize, nullptr, &status);
-    CHECK(status, "Failed to allocate pinned receive buffer");
+// --clock names, indexed by ClockSource.
+const char* const clockShortNames[] = { "hrc", "steady", "raw", "tsc" };
 
-    void* hostPtr = clEnqueueMapBuffer(queue, hostBuf, CL_TRUE, CL_MAP_WRITE, 0, dataSize, 0, nullptr, nullptr, &status);
-    CHECK(status, "Failed to map host buffer");
+// Clock that times each transfer in measure(), chosen by calibrate_clocks().
+// Ticks are nanoseconds except for the TSC.
+struct TransferClock {
+  ClockSource source = ClockSource::HighResolution;
+  double nsPerTick = 1;
+  double readNs = 0;  // cost of one read
+};
 
-    void* recvPtr = clEnqueueMapBuffer(queue, recvBuf, CL_TRUE, CL_MAP_READ, 0, dataSize, 0, nullptr, nullptr, &status);
-    CHECK(status, "Failed to map recv buffer");
+TransferClock transferClock;
 
-    memset(hostPtr, 1, dataSize);
+inline uint64_t read_clock(ClockSource source) {
+  switch (source) {
+    case ClockSource::Steady:
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#ifdef __linux__
+    case ClockSource::MonotonicRaw: {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+      return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+#endif
+#ifdef HAVE_TSC
+    case ClockSource::Tsc:
+      return __rdtsc();
+#endif
+    default:
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+  }
+}
 
-    cl_mem deviceBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, dataSize, nullptr, &status);
-    CHECK(status, "Failed to allocate device buffer");
+inline double clock_seconds(uint64_t from, uint64_t to) {
+  return (to - from) * transferClock.nsPerTick * 1e-9;
+}
 
-    double sumH2D = 0, minH2D = 1e10, maxH2D = 0;
-    double sumD2H = 0, minD2H = 1e10, maxD2H = 0;
+struct ClockCalibration {
+  ClockSource source;
+  bool available = false;
+  double nsPerTick = 1;
+  double readNs = 0;
+  double resolutionNs = 0;  // smallest observed step
+  bool monotonic = true;
+  std::string note;
 
-    for (int i = 0; i < rounds; ++i) {
-      std::cout << "\r  Iteration " << (i + 1) << "/" << rounds << std::flush;
+  bool reliable() const { return available && monotonic && resolutionNs <= 1000; }
+};
 
-      if (direction == Direction::HostToDevice || direction == Direction::Both) {
-        double t = measure(queue, deviceBuffer, hostPtr, dataSize, true);
-        sumH2D += t;
-        minH2D = std::min(minH2D, t);
-        maxH2D = std::max(maxH2D, t);
-      }
+#ifdef HAVE_TSC
+// Invariant TSC (CPUID 0x80000007 EDX bit 8) ticks at a constant rate across
+// P-, C- and T-states.
+bool has_invariant_tsc() {
+#ifdef _WIN32
+  int regs[4];
+  __cpuid(regs, 0x80000000);
+  if (static_cast<unsigned>(regs[0]) < 0x80000007) return false;
+  __cpuid(regs, 0x80000007);
+  return (regs[3] >> 8) & 1;
+#else
+  unsigned a, b, c, d;
+  if (!__get_cpuid(0x80000007, &a, &b, &c, &d)) return false;
+  return (d >> 8) & 1;
+#endif
+}
 
-      if (direction == Direction::DeviceToHost || direction == Direction::Both) {
-        double t = measure(queue, deviceBuffer, recvPtr, dataSize, false);
-        sumD2H += t;
-        minD2H = std::min(minD2H, t);
-        maxD2H = std::max(maxD2H, t);
-      }
+// Nanoseconds per TSC tick measured against steady_clock over 20 ms.
+double tsc_ns_per_tick() {
+  auto s0 = std::chrono::steady_clock::now();
+  uint64_t t0 = __rdtsc();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  auto s1 = std::chrono::steady_clock::now();
+  uint64_t t1 = __rdtsc();
+  return std::chrono::duration<double, std::nano>(s1 - s0).count() / (t1 - t0);
+}
+#endif
+
+ClockCalibration calibrate_clock(ClockSource source) {
+  ClockCalibration cal;
+  cal.source = source;
+  cal.available = true;
+#ifndef __linux__
+  if (source == ClockSource::MonotonicRaw) cal.available = false;
+#endif
+#ifdef HAVE_TSC
+  if (source == ClockSource::Tsc) {
+    double a = tsc_ns_per_tick(), b = tsc_ns_per_tick();
+    cal.nsPerTick = (a + b) / 2;
+    if (!has_invariant_tsc()) {
+      cal.monotonic = false;
+      cal.note = "not invariant";
+    } else if (std::fabs(a - b) > 0.01 * cal.nsPerTick) {
+      cal.monotonic = false;
+      cal.note = "rate unstable";
+    } else {
+      std::ostringstream s;
+      s << "invariant, " << std::fixed << std::setprecision(2) << 1 / cal.nsPerTick << " GHz";
+      cal.note = s.str();
     }
+  }
+#else
+  if (source == ClockSource::Tsc) cal.available = false;
+#endif
+  if (!cal.available) return cal;
 
-    std::cout << std::endl;
+  const int reads = 100000;
+  volatile uint64_t sink = 0;
+  double best = std::numeric_limits<double>::max();
+  for (int batch = 0; batch < 3; ++batch) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reads; ++i) sink = sink + read_clock(source);
+    best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+  }
+  cal.readNs = best / reads;
 
-    auto convert = [=](double sec) {
-      if (unit == Unit::GBps) return dataSize / (sec * 1024.0 * 1024.0 * 1024.0);
-      else                    return dataSize / (sec * 1024.0 * 1024.0);
-    };
-    const char* label = (unit == Unit::GBps) ? "GB/s" : "MB/s";
+  uint64_t minStep = std::numeric_limits<uint64_t>::max();
+  for (int i = 0; i < 1000; ++i) {
+    uint64_t t0 = read_clock(source), t = t0;
+    for (int spin = 0; spin < 1000000 && t == t0; ++spin) t = read_clock(source);
+    if (t < t0) cal.monotonic = false;
+    else if (t > t0) minStep = std::min(minStep, t - t0);
+  }
+  cal.resolutionNs = minStep == std::numeric_limits<uint64_t>::max() ? 1e9 : minStep * cal.nsPerTick;
+  return cal;
+}
 
-    if (direction == Direction::HostToDevice || direction == Direction::Both) {
-      std::cout << "Host to Device:\n";
-      std::cout << "  Avg: " << convert(sumH2D / rounds) << " " << label << "\n";
-      std::cout << "  Min: " << convert(maxH2D) << " " << label << "\n";
-      std::cout << "  Max: " << convert(minH2D) << " " << label << "\n";
+// Measures all clocks and selects the cheapest reliable one for measure(),
+// unless one was forced with --clock (hrc, steady, raw or tsc).
+std::vector<ClockCalibration> calibrate_clocks(const std::string& forced) {
+  std::vector<ClockCalibration> cals;
+  for (ClockSource c : { ClockSource::HighResolution, ClockSource::Steady, ClockSource::MonotonicRaw,
+                         ClockSource::Tsc }) {
+    cals.push_back(calibrate_clock(c));
+  }
+  const ClockCalibration* chosen = nullptr;
+  for (const ClockCalibration& cal : cals) {
+    if (forced == clockShortNames[static_cast<int>(cal.source)] && cal.available) chosen = &cal;
+  }
+  if (forced != "auto" && !chosen) std::cerr << "Clock " << forced << " is not available, selecting automatically\n";
+  if (!chosen) {
+    for (const ClockCalibration& cal : cals) {
+      if (cal.reliable() && (!chosen || cal.readNs < chosen->readNs)) chosen = &cal;
     }
+  }
+  if (chosen) {
+    transferClock.source = chosen->source;
+    transferClock.nsPerTick = chosen->nsPerTick;
+    transferClock.readNs = chosen->readNs;
+  }
+  return cals;
+}
+
+// Aborts the process when a transfer stays in flight longer than the timeout
+// instead of blocking forever inside the driver; output printed so far (e.g.
+// the soak time series) is already flushed.
+struct Watchdog {
+  double timeout = 0;
+  std::atomic<double> since{-1};
+  std::atomic<bool> write{false};
+  std::atomic<size_t> size{0};
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopping = false;
+
+  ~Watchdog() { stop(); }
+
+  void start(double timeoutSeconds) {
+    timeout = timeoutSeconds;
+    if (timeout <= 0) return;
+    thread = std::thread([this] {
+      auto interval = std::chrono::duration<double>(std::min(0.1, timeout / 10));
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!cv.wait_for(lock, interval, [this] { return stopping; })) {
+        double t = since.load();
+        if (t < 0 || elapsed_seconds() - t < timeout) continue;
+        std::cerr << "\nWatchdog: " << (write ? "host to device" : "device to host") << " transfer of "
+                  << size << " bytes has not completed after " << elapsed_seconds() - t
+                  << " s (started at t=" << t << " s), transfer is hung; aborting\n";
+        std::_Exit(2);
+      }
+    });
+  }
+
+  void arm(bool isWrite, size_t bytes) {
+    write = isWrite;
+    size = bytes;
+    since = elapsed_seconds();
+  }
+
+  void disarm() { since = -1; }
 
-    if (direction == Direction::DeviceToHost || direction == Direction::Both) {
-      std::cout << "Device to Host:\n";
-      std::cout << "  Avg: " << convert(sumD2H / rounds) << " " << label << "\n";
-      std::cout << "  Min: " << convert(maxD2H) << " " << label << "\n";
-      std::cout << "  Max: " << convert(minD2H) << " " << label << "\n";
+  void stop() {
+    if (!thread.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
     }
+    cv.notify_all();
+    thread.join();
+  }
+};
 
-    clEnqueueUnmapMemObject(queue, hostBuf, hostPtr, 0, nullptr, nullptr);
-    clEnqueueUnmapMemObject(queue, recvBuf, recvPtr, 0, nullptr, nullptr);
+#ifndef _WIN32
+std::string read_first_line(const std::string& path) {
+  std::ifstream f(path);
+  std::string line;
+  std::getline(f, line);
+  return line;
+}
+
+bool read_number(const std::string& path, double& value) {
+  std::ifstream f(path);
+  return static_cast<bool>(f >> value);
+}
 
-    clReleaseMemObject(hostBuf);
-    clReleaseMemObject(recvBuf);
-    clReleaseMemObject(deviceBuffer);
+std::vector<std::string> list_dir(const std::string& path) {
+  std::vector<std::string> names;
+  DIR* dir = opendir(path.c_str());
+  if (!dir) return names;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..") names.push_back(name);
   }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  return names;
+}
 
-#ifdef _WIN32
-  std::cout << "\nPress Enter to exit...";
-  std::cin.get();
+// GPU hwmon chips are recognized by driver name or by a display-class
+// (0x03xxxx) PCI parent device.
+bool is_gpu_hwmon(const std::string& base) {
+  static const char* const gpuDrivers[] = { "amdgpu", "radeon", "nouveau", "i915", "xe" };
+  std::string name = read_first_line(base + "/name");
+  return std::find(std::begin(gpuDrivers), std::end(gpuDrivers), name) != std::end(gpuDrivers) ||
+         read_first_line(base + "/device/class").rfind("0x03", 0) == 0;
+}
 #endif
 
-  clReleaseCommandQueue(queue);
-  clReleaseContext(context);
-  return 0;
+const int maxSensors = 32;
+
+struct SensorSample {
+  double timestamp = 0;
+  double cpuFreqMHz = 0;  // of the core the submitting thread last ran on
+  int cpu = -1;
+  float value[maxSensors] = {};
+};
+
+// Samples GPU hwmon sensors and the submitting core's cpufreq on a background
+// thread. Samples go through a single-producer/single-consumer ring so the
+// sampler never blocks on, or is blocked by, the measuring thread; when the
+// consumer falls behind, new samples are dropped and counted.
+struct SensorSampler {
+  struct Sensor {
+    std::string label;
+    std::string path;
+    double scale;
+    const char* unit;
+  };
+
+  static const size_t ringSize = 4096;  // power of two
+  std::vector<Sensor> sensors;
+  std::string cpufreqPattern;           // path with %d for the CPU number
+  std::vector<SensorSample> ring = std::vector<SensorSample>(ringSize);
+  std::atomic<size_t> head{0}, tail{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<int> currentCpu{-1};
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopping = false;
+
+  ~SensorSampler() { stop(); }
+
+  bool running() const { return thread.joinable(); }
+
+#ifdef _WIN32
+  void start(const std::string&, double) {
+    std::cerr << "Warning: sensor sampling is only supported on Linux\n";
+  }
+  void note_cpu() {}
+#else
+  void discover(const std::string& root) {
+    std::string hwmonDir = root + "/class/hwmon";
+    for (const std::string& chip : list_dir(hwmonDir)) {
+      std::string base = hwmonDir + "/" + chip;
+      if (!is_gpu_hwmon(base)) continue;
+      std::string name = read_first_line(base + "/name");
+      for (const std::string& file : list_dir(base)) {
+        double scale = 0;
+        const char* unit = "";
+        size_t us = file.find('_');
+        if (us == std::string::npos) continue;
+        std::string kind = file.substr(0, us), attr = file.substr(us + 1);
+        if (kind.rfind("temp", 0) == 0 && attr == "input")          { scale = 1e-3; unit = "C"; }
+        else if (kind.rfind("power", 0) == 0 && (attr == "average" || attr == "input")) { scale = 1e-6; unit = "W"; }
+        else if (kind.rfind("fan", 0) == 0 && attr == "input")      { scale = 1; unit = "RPM"; }
+        else continue;
+        std::string label = read_first_line(base + "/" + kind + "_label");
+        Sensor sensor = { name + " " + (label.empty() ? kind : label), base + "/" + file, scale, unit };
+        if (sensors.size() < static_cast<size_t>(maxSensors)) sensors.push_back(sensor);
+      }
+    }
+    cpufreqPattern = root + "/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq";
+  }
+
+  void start(const std::string& root, double rate) {
+    discover(root);
+    if (sensors.empty()) std::cerr << "Warning: no GPU hwmon sensors found under " << root << "/class/hwmon\n";
+    note_cpu();
+    auto interval = std::chrono::duration<double>(1.0 / std::max(rate, 0.1));
+    thread = std::thread([this, interval] {
+      std::unique_lock<std::mutex> lock(mutex);
+      do {
+        sample_once();
+      } while (!cv.wait_for(lock, interval, [this] { return stopping; }));
+    });
+  }
+
+  void sample_once() {
+    SensorSample sample;
+    sample.timestamp = elapsed_seconds();
+    sample.cpu = currentCpu.load(std::memory_order_relaxed);
+    if (sample.cpu >= 0) {
+      char path[512];
+      snprintf(path, sizeof(path), cpufreqPattern.c_str(), sample.cpu);
+      double khz = 0;
+      if (read_number(path, khz)) sample.cpuFreqMHz = khz / 1000;
+    }
+    for (size_t i = 0; i < sensors.size(); ++i) {
+      double v = 0;
+      if (read_number(sensors[i].path, v)) sample.value[i] = static_cast<float>(v * sensors[i].scale);
+    }
+
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= ringSize) {
+      ++dropped;
+      return;
+    }
+    ring[h & (ringSize - 1)] = sample;
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  void note_cpu() {
+    currentCpu.store(sched_getcpu(), std::memory_order_relaxed);
+  }
+#endif
+
+  // Moves all queued samples into out (consumer side).
+  void drain(std::vector<SensorSample>& out) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    for (; t != h; ++t) out.push_back(ring[t & (ringSize - 1)]);
+    tail.store(t, std::memory_order_release);
+  }
+
+  void stop() {
+    if (!thread.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+  }
+};
+
+// Cumulative energy counters read around every transfer: RAPL package and
+// DRAM domains (intel-rapl is also used by AMD CPUs) and GPU hwmon energy
+// inputs. Files stay open and are re-read with pread to keep the per-transfer
+// cost at a few syscalls. RAPL updates roughly every millisecond, so energy
+// for short transfers is only meaningful summed over many rounds.
+struct EnergyMeter {
+  struct Domain {
+    std::string label;
+    int fd;
+    double range;  // counter wrap-around in microjoules, 0 = does not wrap
+  };
+
+  std::vector<Domain> domains;
+
+  ~EnergyMeter() { close(); }
+
+  bool available() const { return !domains.empty(); }
+
+#ifdef _WIN32
+  void open(const std::string&) {
+    std::cerr << "Warning: energy accounting is only supported on Linux\n";
+  }
+  void close() {}
+  void read(std::vector<double>&) const {}
+#else
+  void add(const std::string& label, const std::string& path, double range, bool& denied) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      if (errno == EACCES) denied = true;
+      return;
+    }
+    domains.push_back({ label, fd, range });
+  }
+
+  void open(const std::string& root) {
+    bool denied = false;
+    std::string powercap = root + "/class/powercap";
+    for (const std::string& zone : list_dir(powercap)) {
+      if (zone.rfind("intel-rapl:", 0) != 0) continue;
+      std::string base = powercap + "/" + zone;
+      std::string name = read_first_line(base + "/name");
+      if (name.rfind("package", 0) != 0 && name != "dram") continue;
+      double range = 0;
+      read_number(base + "/max_energy_range_uj", range);
+      add(name, base + "/energy_uj", range, denied);
+    }
+
+    std::string hwmonDir = root + "/class/hwmon";
+    for (const std::string& chip : list_dir(hwmonDir)) {
+      std::string base = hwmonDir + "/" + chip;
+      if (!is_gpu_hwmon(base)) continue;
+      for (const std::string& file : list_dir(base)) {
+        if (file.rfind("energy", 0) != 0 || file.find("_input") == std::string::npos) continue;
+        add(read_first_line(base + "/name") + " " + file.substr(0, file.find('_')), base + "/" + file, 0, denied);
+      }
+    }
+
+    if (denied) std::cerr << "Warning: some energy counters are not readable (RAPL usually requires root)\n";
+    if (domains.empty()) std::cerr << "Warning: no RAPL or GPU energy counters found under " << root << "\n";
+  }
+
+  void close() {
+    for (Domain& d : domains) ::close(d.fd);
+    domains.clear();
+  }
+
+  // Current counter values in microjoules, NaN where the read failed.
+  void read(std::vector<double>& values) const {
+    values.resize(domains.size());
+    char buf[32];
+    for (size_t i = 0; i < domains.size(); ++i) {
+      ssize_t n = pread(domains[i].fd, buf, sizeof(buf) - 1, 0);
+      buf[n > 0 ? n : 0] = 0;
+      values[i] = n > 0 ? strtod(buf, nullptr) : std::nan("");
+    }
+  }
+#endif
+
+  // Adds the energy between two readings, in joules, to total.
+  void accumulate(const std::vector<double>& before, const std::vector<double>& after,
+                  std::vector<double>& total) const {
+    total.resize(domains.size());
+    for (size_t i = 0; i < domains.size() && i < before.size() && i < after.size(); ++i) {
+      double delta = after[i] - before[i];
+      if (delta < 0 && domains[i].range > 0) delta += domains[i].range;
+      if (delta > 0) total[i] += delta * 1e-6;  // false for NaN
+    }
+  }
+};
+
+std::string format_pci_address(unsigned domain, unsigned bus, unsigned device, unsigned function) {
+  char address[32];
+  snprintf(address, sizeof(address), "%04x:%02x:%02x.%x", domain, bus, device, function);
+  return address;
+}
+
+// PCI address of an OpenCL device as "dddd:bb:dd.f". Tries cl_khr_pci_bus_info,
+// then the AMD and NVIDIA vendor queries, then falls back to the index-th
+// display-class device with the same vendor ID in sysfs. Empty if unknown.
+std::string get_pci_address(cl_device_id device, const std::string& sysfsRoot, int index) {
+  cl_device_pci_bus_info_khr info;
+  if (clGetDeviceInfo(device, CL_DEVICE_PCI_BUS_INFO_KHR, sizeof(info), &info, nullptr) == CL_SUCCESS) {
+    return format_pci_address(info.pci_domain, info.pci_bus, info.pci_device, info.pci_function);
+  }
+
+  device_topology_amd topology;
+  if (clGetDeviceInfo(device, CL_DEVICE_TOPOLOGY_AMD, sizeof(topology), &topology, nullptr) == CL_SUCCESS &&
+      topology.raw.type == CL_DEVICE_TOPOLOGY_TYPE_PCIE_AMD_) {
+    return format_pci_address(0, static_cast<unsigned char>(topology.pcie.bus),
+                              static_cast<unsigned char>(topology.pcie.device),
+                              static_cast<unsigned char>(topology.pcie.function));
+  }
+
+  cl_uint bus = 0, slot = 0, domain = 0;
+  if (clGetDeviceInfo(device, CL_DEVICE_PCI_BUS_ID_NV, sizeof(bus), &bus, nullptr) == CL_SUCCESS &&
+      clGetDeviceInfo(device, CL_DEVICE_PCI_SLOT_ID_NV, sizeof(slot), &slot, nullptr) == CL_SUCCESS) {
+    clGetDeviceInfo(device, CL_DEVICE_PCI_DOMAIN_ID_NV, sizeof(domain), &domain, nullptr);
+    return format_pci_address(domain, bus, slot >> 3, slot & 7);
+  }
+
+#ifndef _WIN32
+  cl_uint vendor = 0;
+  clGetDeviceInfo(device, CL_DEVICE_VENDOR_ID, sizeof(vendor), &vendor, nullptr);
+  std::string devicesDir = sysfsRoot + "/bus/pci/devices";
+  std::vector<std::string> matches;
+  for (const std::string& address : list_dir(devicesDir)) {
+    std::string base = devicesDir + "/" + address;
+    if (read_first_line(base + "/class").rfind("0x03", 0) != 0) continue;
+    if (strtoul(read_first_line(base + "/vendor").c_str(), nullptr, 16) != vendor) continue;
+    matches.push_back(address);
+  }
+  if (index >= 0 && static_cast<size_t>(index) < matches.size()) return matches[index];
+#else
+  (void)sysfsRoot;
+  (void)index;
+#endif
+  return "";
+}
+
+std::string get_device_name(cl_device_id device) {
+  size_t size = 0;
+  clGetDeviceInfo(device, CL_DEVICE_NAME, 0, nullptr, &size);
+  std::string name(size, '\0');
+  clGetDeviceInfo(device, CL_DEVICE_NAME, size, &name[0], nullptr);
+  name.resize(strlen(name.c_str()));
+  return name;
+}
+
+struct LinkState {
+  bool valid = false;
+  std::string speed;          // e.g. "16.0 GT/s PCIe"
+  int width = 0;
+  int64_t correctable = -1;   // AER totals, -1 if not exposed
+  int64_t nonfatal = -1;
+};
+
+#ifndef _WIN32
+// Reads the TOTAL_ERR_* line of an aer_dev_* file.
+int64_t read_aer_total(const std::string& path) {
+  std::ifstream f(path);
+  std::string key;
+  int64_t value;
+  while (f >> key >> value) {
+    if (key.rfind("TOTAL_ERR", 0) == 0) return value;
+  }
+  return -1;
+}
+
+LinkState read_link_state(const std::string& devicePath) {
+  LinkState state;
+  state.speed = read_first_line(devicePath + "/current_link_speed");
+  state.width = atoi(read_first_line(devicePath + "/current_link_width").c_str());
+  state.correctable = read_aer_total(devicePath + "/aer_dev_correctable");
+  state.nonfatal = read_aer_total(devicePath + "/aer_dev_nonfatal");
+  state.valid = !state.speed.empty() || state.correctable >= 0;
+  return state;
+}
+#else
+LinkState read_link_state(const std::string&) {
+  return LinkState();
+}
+#endif
+
+// Theoretical PCIe throughput of the GPU's link. Per lane, Gen1/2 use 8b/10b,
+// Gen3-5 128b/130b and Gen6 FLIT mode (242 of 256 bytes carry TLPs). Every
+// TLP of at most MPS payload bytes also carries a 16-byte header (64-bit
+// addressing), a 2-byte sequence number, a 4-byte LCRC and framing (2 bytes
+// for Gen1/2, 4 from Gen3). DLLP traffic (ACKs, flow control) is ignored, so
+// the payload figure is an upper bound. The budget uses the maximum link the
+// device and its upstream port both support: idle links train down to save
+// power, so the current speed and width read before a run are informational.
+struct LinkBudget {
+  bool valid = false;
+  double speed = 0, maxSpeed = 0;  // GT/s; speed and width as negotiated when read
+  int width = 0, maxWidth = 0;
+  int mps = 256;                   // bytes
+  bool mpsAssumed = true;
+  double rawBytesPerSec = 0;       // after line encoding
+  double payloadBytesPerSec = 0;   // after TLP overhead
+
+  static int generation(double gts) {
+    if (gts <= 2.5) return 1;
+    if (gts <= 5) return 2;
+    if (gts <= 8) return 3;
+    if (gts <= 16) return 4;
+    if (gts <= 32) return 5;
+    return 6;
+  }
+
+  void compute() {
+    if (maxSpeed <= 0) maxSpeed = speed;
+    if (maxWidth <= 0) maxWidth = width;
+    int gen = generation(maxSpeed);
+    double encoding = gen <= 2 ? 8.0 / 10 : gen <= 5 ? 128.0 / 130 : 242.0 / 256;
+    double overhead = 16 + 2 + 4 + (gen <= 2 ? 2 : 4);
+    rawBytesPerSec = maxSpeed * 1e9 * maxWidth * encoding / 8;
+    payloadBytesPerSec = rawBytesPerSec * mps / (mps + overhead);
+    valid = rawBytesPerSec > 0;
+  }
+};
+
+#ifndef _WIN32
+// Max Payload Size from the Device Control register of the PCI Express
+// capability. Unprivileged reads of config space stop after 64 bytes, which
+// usually excludes the capability; returns 0 then.
+int read_max_payload_size(const std::string& devicePath) {
+  std::ifstream f(devicePath + "/config", std::ios::binary);
+  std::vector<unsigned char> cfg((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  if (cfg.size() < 64 || !(cfg[0x06] & 0x10)) return 0;
+  size_t ptr = cfg[0x34] & 0xFC;
+  for (int guard = 0; ptr >= 0x40 && ptr + 10 <= cfg.size() && guard < 48; ++guard) {
+    if (cfg[ptr] == 0x10) {
+      unsigned devctl = cfg[ptr + 8] | (cfg[ptr + 9] << 8);
+      return 128 << ((devctl >> 5) & 7);
+    }
+    ptr = cfg[ptr + 1] & 0xFC;
+  }
+  return 0;
+}
+
+LinkBudget read_link_budget(const std::string& devicePath) {
+  LinkBudget b;
+  b.speed = atof(read_first_line(devicePath + "/current_link_speed").c_str());
+  b.width = atoi(read_first_line(devicePath + "/current_link_width").c_str());
+  b.maxSpeed = atof(read_first_line(devicePath + "/max_link_speed").c_str());
+  b.maxWidth = atoi(read_first_line(devicePath + "/max_link_width").c_str());
+  // A Gen5 card in a Gen4 slot trains to Gen4: cap by the upstream port.
+  char* resolved = realpath(devicePath.c_str(), nullptr);
+  if (resolved) {
+    std::string parent(resolved);
+    free(resolved);
+    parent.erase(parent.rfind('/'));
+    double upSpeed = atof(read_first_line(parent + "/max_link_speed").c_str());
+    int upWidth = atoi(read_first_line(parent + "/max_link_width").c_str());
+    if (upSpeed > 0 && (b.maxSpeed <= 0 || upSpeed < b.maxSpeed)) b.maxSpeed = upSpeed;
+    if (upWidth > 0 && (b.maxWidth <= 0 || upWidth < b.maxWidth)) b.maxWidth = upWidth;
+  }
+  int mps = read_max_payload_size(devicePath);
+  if (mps > 0) {
+    b.mps = mps;
+    b.mpsAssumed = false;
+  }
+  b.compute();
+  return b;
+}
+#else
+LinkBudget read_link_budget(const std::string&) {
+  return LinkBudget();
+}
+#endif
+
+// Watches the GPU's PCIe link around each size run: AER counters and link
+// speed/width before and after, plus a check between transfers at most every
+// 100 ms to catch retraining while the run is in progress.
+struct LinkMonitor {
+  struct Change {
+    double timestamp;
+    LinkState from, to;
+  };
+
+  std::string address;
+  std::string path;
+  LinkBudget budget;
+  LinkState base, last;
+  double peakSpeed = 0;  // fastest and widest state seen between transfers
+  int peakWidth = 0;
+  double lastCheck = 0;
+  std::vector<Change> changes;
+
+  bool enabled() const { return !path.empty(); }
+
+  void open(const std::string& root, const std::string& pciAddress) {
+    address = pciAddress;
+    if (address.empty()) return;
+    path = root + "/bus/pci/devices/" + address;
+    if (!read_link_state(path).valid) {
+      std::cerr << "Warning: no PCIe link information in " << path << "\n";
+      path.clear();
+      return;
+    }
+    budget = read_link_budget(path);
+  }
+
+  void begin() {
+    if (!enabled()) return;
+    base = last = read_link_state(path);
+    lastCheck = elapsed_seconds();
+    changes.clear();
+    peakSpeed = 0;
+    peakWidth = 0;
+  }
+
+  // Cheap unless 100 ms have passed since the last check.
+  void poll() {
+    if (!enabled()) return;
+    double now = elapsed_seconds();
+    if (now - lastCheck < 0.1) return;
+    lastCheck = now;
+    LinkState state = read_link_state(path);
+    // begin() usually sees the idle link; it training up to speed on the first
+    // transfers is power management, not a retrain. Record drops, and any
+    // change after one.
+    bool down = atof(state.speed.c_str()) < atof(last.speed.c_str()) || state.width < last.width;
+    if ((state.speed != last.speed || state.width != last.width) && (down || !changes.empty())) {
+      changes.push_back({ now, last, state });
+    }
+    peakSpeed = std::max(peakSpeed, atof(state.speed.c_str()));
+    peakWidth = std::max(peakWidth, state.width);
+    last = state;
+  }
+
+  // Correctable errors since begin(), -1 if not exposed.
+  int64_t correctable_delta() const {
+    return (last.correctable >= 0 && base.correctable >= 0) ? last.correctable - base.correctable : -1;
+  }
+
+  void end() {
+    if (!enabled()) return;
+    lastCheck = 0;
+    poll();
+  }
+};
+
+// PCI hierarchy above the GPUs, built from the sysfs device paths. Every GPU
+// contributes its chain of bridges from the root port down; a node's gpus
+// lists the OpenCL devices at or below it. A link is shared when the topmost
+// node of a chain segment has more than one GPU below it: that node is always
+// a root or switch downstream port, and its link attributes describe the link
+// towards the switch all those GPUs sit behind.
+struct PciTopology {
+  struct Node {
+    std::string address, parent;  // parent is the root complex ("pci0000:00") for root ports
+    LinkBudget link;
+    std::vector<int> gpus;
+    int gpu = -1;                 // OpenCL device index if this node is a GPU
+  };
+
+  struct Uplink {
+    std::string address;
+    LinkBudget link;
+    std::vector<int> gpus;
+  };
+
+  std::map<std::string, Node> nodes;
+  std::vector<std::string> domains;
+  std::vector<Uplink> uplinks;
+
+  // Adds the chain above a GPU; false if its sysfs path is not known.
+  bool add(const std::string& root, const std::string& address, int gpu) {
+#ifndef _WIN32
+    if (address.empty()) return false;
+    char* resolved = realpath((root + "/bus/pci/devices/" + address).c_str(), nullptr);
+    if (!resolved) return false;
+    std::string path = resolved, prefix, parent;
+    free(resolved);
+    std::stringstream ss(path);
+    std::string part;
+    while (std::getline(ss, part, '/')) {
+      if (part.empty()) continue;
+      prefix += "/" + part;
+      unsigned d, b, s, f;
+      char tail;
+      if (part.rfind("pci", 0) == 0) {
+        parent = part;
+        if (std::find(domains.begin(), domains.end(), part) == domains.end()) domains.push_back(part);
+      } else if (!parent.empty() && sscanf(part.c_str(), "%x:%x:%x.%x%c", &d, &b, &s, &f, &tail) == 4) {
+        Node& node = nodes[part];
+        if (node.address.empty()) {
+          node.address = part;
+          node.parent = parent;
+          node.link = read_link_budget(prefix);
+        }
+        if (std::find(node.gpus.begin(), node.gpus.end(), gpu) == node.gpus.end()) node.gpus.push_back(gpu);
+        parent = part;
+      }
+    }
+    if (parent != address || !nodes.count(address)) return false;
+    nodes[address].gpu = gpu;
+    return true;
+#else
+    (void)root;
+    (void)address;
+    (void)gpu;
+    return false;
+#endif
+  }
+
+  void find_shared_uplinks() {
+    uplinks.clear();
+    for (const auto& entry : nodes) {
+      const Node& node = entry.second;
+      if (node.gpus.size() < 2) continue;
+      auto parent = nodes.find(node.parent);
+      if (parent != nodes.end() && parent->second.gpus.size() == node.gpus.size()) continue;
+      uplinks.push_back({ node.address, node.link, node.gpus });
+    }
+  }
+
+  // Index into uplinks of the shared link a GPU sits behind, -1 if none.
+  // With nested switches this is the one closest to the GPU.
+  int uplink_of(int gpu) const {
+    int best = -1;
+    for (size_t i = 0; i < uplinks.size(); ++i) {
+      const auto& g = uplinks[i].gpus;
+      if (std::find(g.begin(), g.end(), gpu) == g.end()) continue;
+      if (best < 0 || g.size() < uplinks[best].gpus.size()) best = static_cast<int>(i);
+    }
+    return best;
+  }
+};
+
+std::vector<int> parse_cpu_list(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    int first = 0, last = 0;
+    int n = sscanf(item.c_str(), "%d-%d", &first, &last);
+    if (n < 1) continue;
+    if (n == 1) last = first;
+    for (int c = first; c <= last; ++c) cpus.push_back(c);
+  }
+  return cpus;
+}
+
+// Background threads streaming through private buffers far larger than the
+// last-level cache to load host DRAM while transfers run. Each thread may be
+// restricted to a CPU set (the GPU's NUMA node or the SMT siblings of the
+// submitting core). With submitterCpu set, the calling thread is pinned to
+// that core between start() and stop() and its affinity restored after.
+struct MemoryInterference {
+  static const size_t bufferSize = 64 * 1024 * 1024;
+
+  int submitterCpu = -1;
+#ifdef __linux__
+  cpu_set_t submitterMask;
+  bool submitterPinned = false;
+#endif
+
+  std::vector<std::thread> threads;
+  std::atomic<bool> stopping{false};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<int> streaming{0};
+  std::chrono::steady_clock::time_point started;
+
+  // Returns once every thread has its buffers and is streaming.
+  void start(int count, StreamOp op, const std::vector<std::vector<int>>& cpuSets) {
+#ifdef __linux__
+    if (submitterCpu >= 0 && sched_getaffinity(0, sizeof(submitterMask), &submitterMask) == 0) {
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      CPU_SET(submitterCpu, &mask);
+      submitterPinned = sched_setaffinity(0, sizeof(mask), &mask) == 0;
+    }
+#endif
+    stopping = false;
+    streaming = 0;
+    for (int i = 0; i < count; ++i) {
+      std::vector<int> cpus = cpuSets.empty() ? std::vector<int>() : cpuSets[i % cpuSets.size()];
+      threads.emplace_back([this, op, cpus] { stream(op, cpus); });
+    }
+    while (streaming.load() < count) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    bytes = 0;
+    started = std::chrono::steady_clock::now();
+  }
+
+  // Stops all threads and returns the host memory traffic they generated in
+  // bytes per second.
+  double stop() {
+    stopping = true;
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    bool ran = !threads.empty();
+    threads.clear();
+#ifdef __linux__
+    if (submitterPinned) sched_setaffinity(0, sizeof(submitterMask), &submitterMask);
+    submitterPinned = false;
+#endif
+    return ran && seconds > 0 ? bytes / seconds : 0;
+  }
+
+  void stream(StreamOp op, const std::vector<int>& cpus) {
+#ifdef __linux__
+    if (!cpus.empty()) {
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      for (int c : cpus) CPU_SET(c, &mask);
+      sched_setaffinity(0, sizeof(mask), &mask);
+    }
+#else
+    (void)cpus;
+#endif
+    const size_t words = bufferSize / sizeof(uint64_t);
+    std::vector<uint64_t> src(words, 1), dst(op == StreamOp::Copy ? words : 0);
+    volatile uint64_t sink = 0;
+    streaming.fetch_add(1);
+    while (!stopping.load(std::memory_order_relaxed)) {
+      switch (op) {
+        case StreamOp::Read: {
+          uint64_t sum = 0;
+          for (size_t i = 0; i < words; ++i) sum += src[i];
+          sink = sum;
+          bytes += bufferSize;
+          break;
+        }
+        case StreamOp::Write:
+          std::fill(src.begin(), src.end(), sink + 1);
+          bytes += bufferSize;
+          break;
+        case StreamOp::Copy:
+          memcpy(dst.data(), src.data(), bufferSize);
+          bytes += 2 * bufferSize;
+          break;
+      }
+    }
+  }
+};
+
+// CPU sets for the interference threads: "numa" keeps them on the GPU's NUMA
+// node, "smt" puts one on each SMT sibling of the submitting core and sets
+// submitterCpu to that core. Empty means unpinned.
+std::vector<std::vector<int>> interference_cpu_sets(const std::string& pin, const std::string& sysfsRoot,
+                                                    const std::string& pciAddress, std::string& description,
+                                                    int& submitterCpu) {
+  std::vector<std::vector<int>> sets;
+  description = "unpinned";
+  submitterCpu = -1;
+#ifdef __linux__
+  if (pin == "numa") {
+    std::string node = pciAddress.empty() ? "" : read_first_line(sysfsRoot + "/bus/pci/devices/" + pciAddress +
+                                                                 "/numa_node");
+    std::vector<int> cpus;
+    if (!node.empty() && atoi(node.c_str()) >= 0) {
+      cpus = parse_cpu_list(read_first_line(sysfsRoot + "/devices/system/node/node" + node + "/cpulist"));
+    }
+    if (cpus.empty()) {
+      std::cerr << "Warning: NUMA node of the GPU unknown, interference threads are not pinned\n";
+    } else {
+      sets.push_back(cpus);
+      description = "NUMA node " + node;
+    }
+  } else if (pin == "smt") {
+    int cpu = sched_getcpu();
+    std::vector<int> siblings = parse_cpu_list(read_first_line(
+      sysfsRoot + "/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list"));
+    for (int c : siblings) {
+      if (c != cpu) sets.push_back({ c });
+    }
+    if (sets.empty()) {
+      std::cerr << "Warning: CPU " << cpu << " has no SMT siblings, interference threads are not pinned\n";
+    } else {
+      submitterCpu = cpu;
+      description = "SMT siblings of CPU " + std::to_string(cpu) + ", submitting thread pinned to it";
+    }
+  }
+#else
+  (void)sysfsRoot;
+  (void)pciAddress;
+  if (pin != "none") std::cerr << "Warning: interference thread pinning is not supported on this platform\n";
+#endif
+  return sets;
+}
+
+// Opt-in low-noise configuration for the measuring thread (--stabilize):
+// SCHED_FIFO, all memory locked, pinned to an isolated core (the last allowed
+// core if none is isolated) with every other thread of the process moved off
+// it. Applied around each stabilized pass and reverted afterwards, so the
+// baseline pass next to it runs in the normal configuration.
+struct Stabilizer {
+  bool active = false;
+  int cpu = -1;
+  bool isolated = false;
+  bool fifo = false, locked = false;
+  size_t movedCount = 0;  // other threads moved off the CPU by the last apply()
+  std::vector<std::string> problems;
+#ifdef __linux__
+  cpu_set_t originalMask;
+  int originalPolicy = SCHED_OTHER;
+  sched_param originalParam{};
+  std::vector<std::pair<pid_t, cpu_set_t>> moved;
+
+  void apply(const std::string& sysfsRoot) {
+    problems.clear();
+    pthread_getschedparam(pthread_self(), &originalPolicy, &originalParam);
+    sched_getaffinity(0, sizeof(originalMask), &originalMask);
+
+    cpu = -1;
+    isolated = false;
+    for (int c : parse_cpu_list(read_first_line(sysfsRoot + "/devices/system/cpu/isolated"))) {
+      if (c < CPU_SETSIZE && CPU_ISSET(c, &originalMask)) {
+        cpu = c;
+        isolated = true;
+        break;
+      }
+    }
+    for (int c = CPU_SETSIZE - 1; cpu < 0 && c >= 0; --c) {
+      if (CPU_ISSET(c, &originalMask)) cpu = c;
+    }
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) problems.push_back(std::string("pinning: ") + strerror(errno));
+
+    // Threads of the driver, the sensor sampler and the watchdog
+    pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+    moved.clear();
+    for (const std::string& task : list_dir("/proc/self/task")) {
+      pid_t tid = static_cast<pid_t>(atoi(task.c_str()));
+      if (tid <= 0 || tid == self) continue;
+      cpu_set_t old, away;
+      if (sched_getaffinity(tid, sizeof(old), &old) != 0) continue;
+      away = old;
+      CPU_CLR(cpu, &away);
+      if (CPU_COUNT(&away) == 0 || CPU_EQUAL(&away, &old)) continue;
+      if (sched_setaffinity(tid, sizeof(away), &away) == 0) moved.push_back({ tid, old });
+    }
+    movedCount = moved.size();
+
+    sched_param param{};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 49;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    fifo = err == 0;
+    if (!fifo) problems.push_back(std::string("SCHED_FIFO: ") + strerror(err));
+
+    locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    if (!locked) problems.push_back(std::string("mlockall: ") + strerror(errno));
+    active = true;
+  }
+
+  void revert() {
+    if (!active) return;
+    if (locked) munlockall();
+    if (fifo) pthread_setschedparam(pthread_self(), originalPolicy, &originalParam);
+    for (const auto& m : moved) sched_setaffinity(m.first, sizeof(m.second), &m.second);
+    sched_setaffinity(0, sizeof(originalMask), &originalMask);
+    moved.clear();
+    active = false;
+  }
+#else
+  void apply(const std::string&) {
+    problems = { "not supported on this platform" };
+  }
+
+  void revert() {
+  }
+#endif
+};
+
+// CRC32C (Castagnoli). Uses the SSE4.2 or ARMv8 CRC instructions when the
+// CPU has them, a table otherwise.
+uint32_t crc32c_software(uint32_t crc, const unsigned char* p, size_t n) {
+  static const std::vector<uint32_t> table = [] {
+    std::vector<uint32_t> t(256);
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+      t[i] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  while (n--) crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+#ifdef HAVE_TSC
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p, size_t n) {
+  crc = ~crc;
+#if defined(__x86_64__) || defined(_M_X64)
+  uint64_t c = crc;
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  crc = static_cast<uint32_t>(c);
+#endif
+  for (; n >= 4; n -= 4, p += 4) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    crc = _mm_crc32_u32(crc, v);
+  }
+  while (n--) crc = _mm_crc32_u8(crc, *p++);
+  return ~crc;
+}
+#endif
+
+#ifdef HAVE_ARM_CRC
+__attribute__((target("+crc")))
+uint32_t crc32c_arm(uint32_t crc, const unsigned char* p, size_t n) {
+  crc = ~crc;
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    crc = __crc32cd(crc, v);
+  }
+  while (n--) crc = __crc32cb(crc, *p++);
+  return ~crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cFunction)(uint32_t, const unsigned char*, size_t);
+
+Crc32cFunction select_crc32c(const char** name) {
+#ifdef HAVE_TSC
+  if (__builtin_cpu_supports("sse4.2")) {
+    *name = "SSE4.2";
+    return crc32c_sse42;
+  }
+#endif
+#ifdef HAVE_ARM_CRC
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    *name = "ARMv8 CRC";
+    return crc32c_arm;
+  }
+#endif
+  *name = "software";
+  return crc32c_software;
+}
+
+// End-to-end data check (--verify). The reference buffer's CRC32C is computed
+// per 1 MB chunk, in parallel and outside any timed region; received data is
+// checked the same way and, on a mismatch, compared byte by byte within the
+// first bad chunk to report the exact offset.
+struct Verifier {
+  static const size_t chunkSize = 1024 * 1024;
+
+  struct Failure {
+    std::string what;
+    size_t offset;
+    unsigned expected, actual;  // bytes at offset
+  };
+
+  bool enabled = false;
+  bool everyTransfer = false;
+  Crc32cFunction crc = nullptr;
+  const char* crcName = "";
+  const unsigned char* reference = nullptr;
+  size_t size = 0;
+  std::vector<uint32_t> expected;
+  uint64_t checks = 0, failureCount = 0;
+  double crcBytes = 0, crcSeconds = 0;
+  std::vector<Failure> failures;  // first few
+
+  std::vector<uint32_t> chunk_crcs(const unsigned char* data) {
+    auto start = std::chrono::steady_clock::now();
+    size_t chunks = (size + chunkSize - 1) / chunkSize;
+    std::vector<uint32_t> crcs(chunks);
+    size_t threadCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), chunks));
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+      threads.emplace_back([&, t] {
+        for (size_t c = t; c < chunks; c += threadCount) {
+          size_t offset = c * chunkSize;
+          crcs[c] = crc(0, data + offset, std::min(chunkSize, size - offset));
+        }
+      });
+    }
+    for (auto& th : threads) th.join();
+    crcBytes += size;
+    crcSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return crcs;
+  }
+
+  void prepare(const void* data, size_t dataSize) {
+    if (!enabled) return;
+    if (!crc) crc = select_crc32c(&crcName);
+    reference = static_cast<const unsigned char*>(data);
+    size = dataSize;
+    checks = failureCount = 0;
+    crcBytes = crcSeconds = 0;
+    failures.clear();
+    expected = chunk_crcs(reference);
+  }
+
+  // Compares received data with the reference; false on a mismatch.
+  bool check(const void* data, const std::string& what) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    std::vector<uint32_t> actual = chunk_crcs(bytes);
+    ++checks;
+    for (size_t c = 0; c < actual.size(); ++c) {
+      if (actual[c] == expected[c]) continue;
+      ++failureCount;
+      size_t offset = c * chunkSize, end = std::min(size, offset + chunkSize);
+      while (offset < end && bytes[offset] == reference[offset]) ++offset;
+      if (offset == end) offset = c * chunkSize;  // reference changed under us
+      if (failures.size() < 10) failures.push_back({ what, offset, reference[offset], bytes[offset] });
+      return false;
+    }
+    return true;
+  }
+};
+
+struct Sample {
+  double timestamp = 0;   // elapsed_seconds() at enqueue
+  double seconds = 0;     // wall time from enqueue to observed completion
+  double enqueueSeconds = 0;  // the enqueue call alone, only with --trace
+  cl_ulong queued = 0;    // profiling timestamps (ns), 0 if unavailable
+  cl_ulong submit = 0;
+  cl_ulong start = 0;
+  cl_ulong end = 0;
+};
+
+// Append-only binary log of every timed transfer (--samples). The file starts
+// with a 64-byte header followed by variable-length records:
+//
+//   flags      1 byte: bit 0 read (device to host), bits 1-3 wait mode,
+//              bit 4 size follows, bit 5 device time follows, bit 6 load
+//              follows, bit 7 unstabilized baseline pass (--stabilize)
+//   timestamp  varint, ns since the previous record (first: since start)
+//   size       varint, bytes; only when it differs from the previous record
+//   load       varint, background load threads (--interference); only when
+//              it differs from the previous record
+//   wall       varint, ns from enqueue to observed completion
+//   device     varint, ns between the START and END profiling timestamps
+//
+// On Linux records are written into a MAP_SHARED window of the file that
+// slides forward as it fills, so they are in the page cache the moment they
+// are written and survive a crash, the watchdog abort or Ctrl-C; the
+// header's committed length marks the end of the last complete record.
+// Elsewhere the header is rewritten every flushRecords records, so a crash
+// loses at most the records since the last rewrite.
+struct SampleLog {
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t startUnixNs;  // wall clock at elapsed_seconds() == 0
+    uint64_t committed;    // record bytes after the header
+    uint64_t records;
+    char reserved[24];
+  };
+  static_assert(sizeof(Header) == 64, "sample log header must stay 64 bytes");
+  static constexpr char magic[8] = { 'G', 'P', 'B', 'S', 'M', 'P', 'L', '1' };
+  static const uint64_t window = 4 << 20;
+  static const uint64_t flushRecords = 1024;
+
+  Header header = {};
+  uint64_t lastTimestamp = 0, lastSize = 0, lastLoad = 0;
+  uint64_t load = 0;      // background load threads of the current pass
+  bool baseline = false;  // current pass is the unstabilized baseline
+#ifdef __linux__
+  int fd = -1;
+  Header* mappedHeader = nullptr;  // own mapping of the first page
+  unsigned char* mapped = nullptr;
+  uint64_t mappedOffset = 0;  // file offset of the current window
+
+  bool enabled() const { return fd >= 0; }
+
+  bool map_window(uint64_t offset) {
+    if (mapped) munmap(mapped, window);
+    mapped = nullptr;
+    if (ftruncate(fd, offset + window) != 0) return false;
+    void* p = mmap(nullptr, window, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    if (p == MAP_FAILED) return false;
+    mapped = static_cast<unsigned char*>(p);
+    mappedOffset = offset;
+    return true;
+  }
+
+  void write_bytes(const unsigned char* p, size_t n) {
+    uint64_t pos = sizeof(Header) + header.committed;
+    for (size_t i = 0; i < n; ++i, ++pos) {
+      if (pos >= mappedOffset + window && !map_window(mappedOffset + window)) {
+        std::cerr << "Warning: sample log " << strerror(errno) << ", stopped recording\n";
+        close();
+        return;
+      }
+      mapped[pos - mappedOffset] = p[i];
+    }
+  }
+
+  // Publishes records written so far; a plain store into the shared mapping.
+  void commit(uint64_t bytes) {
+    header.committed += bytes;
+    ++header.records;
+    mappedHeader->committed = header.committed;
+    mappedHeader->records = header.records;
+  }
+#else
+  FILE* file = nullptr;
+
+  bool enabled() const { return file != nullptr; }
+
+  void write_bytes(const unsigned char* p, size_t n) {
+    fwrite(p, 1, n, file);
+  }
+
+  void commit(uint64_t bytes) {
+    header.committed += bytes;
+    ++header.records;
+    if (header.records % flushRecords == 0) {
+      fflush(file);
+      fseek(file, 0, SEEK_SET);
+      fwrite(&header, sizeof(header), 1, file);
+      fseek(file, 0, SEEK_END);
+      fflush(file);
+    }
+  }
+#endif
+
+  bool open(const std::string& path) {
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = 1;
+    header.headerSize = sizeof(Header);
+    auto unixNow = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    header.startUnixNs = static_cast<uint64_t>(unixNow - std::llround(elapsed_seconds() * 1e9));
+#ifdef __linux__
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !map_window(0)) {
+      std::cerr << "Cannot open sample log " << path << ": " << strerror(errno) << "\n";
+      if (fd >= 0) ::close(fd);
+      fd = -1;
+      return false;
+    }
+    void* p = mmap(nullptr, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      std::cerr << "Cannot map sample log " << path << ": " << strerror(errno) << "\n";
+      close();
+      return false;
+    }
+    mappedHeader = static_cast<Header*>(p);
+    *mappedHeader = header;
+#else
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+      std::cerr << "Cannot open sample log " << path << "\n";
+      return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+#endif
+    return true;
+  }
+
+  static size_t put_varint(unsigned char* p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+      p[n++] = static_cast<unsigned char>(v | 0x80);
+      v >>= 7;
+    }
+    p[n++] = static_cast<unsigned char>(v);
+    return n;
+  }
+
+  void add(const Sample& sample, size_t size, bool write, WaitMode mode) {
+    if (!enabled()) return;
+    uint64_t timestamp = static_cast<uint64_t>(std::llround(sample.timestamp * 1e9));
+    uint64_t device = sample.end > sample.start ? sample.end - sample.start : 0;
+    unsigned char record[64];
+    size_t n = 1;
+    record[0] = static_cast<unsigned char>((write ? 0 : 1) | static_cast<int>(mode) << 1 |
+                                           (size != lastSize ? 0x10 : 0) | (device ? 0x20 : 0) |
+                                           (load != lastLoad ? 0x40 : 0) | (baseline ? 0x80 : 0));
+    n += put_varint(record + n, timestamp > lastTimestamp ? timestamp - lastTimestamp : 0);
+    if (size != lastSize) n += put_varint(record + n, size);
+    if (load != lastLoad) n += put_varint(record + n, load);
+    n += put_varint(record + n, static_cast<uint64_t>(std::llround(sample.seconds * 1e9)));
+    if (device) n += put_varint(record + n, device);
+    lastTimestamp = std::max(lastTimestamp, timestamp);
+    lastSize = size;
+    lastLoad = load;
+    write_bytes(record, n);
+    if (enabled()) commit(n);
+  }
+
+  // Trims the file to the committed length.
+  void close() {
+#ifdef __linux__
+    if (fd < 0) return;
+    if (mapped) munmap(mapped, window);
+    if (mappedHeader) munmap(mappedHeader, sizeof(Header));
+    mapped = nullptr;
+    mappedHeader = nullptr;
+    if (ftruncate(fd, sizeof(Header) + header.committed) != 0) {
+      std::cerr << "Warning: cannot trim sample log: " << strerror(errno) << "\n";
+    }
+    ::close(fd);
+    fd = -1;
+#else
+    if (!file) return;
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    file = nullptr;
+#endif
+  }
+};
+
+// Decodes a --samples log into CSV, one row per transfer with integer
+// nanoseconds. Stops at the committed length, so a log cut short by a crash
+// converts up to its last complete record.
+int samples_to_csv(const std::string& path, std::ostream& out) {
+  std::ifstream in(path, std::ios::binary);
+  SampleLog::Header header;
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.magic, SampleLog::magic, sizeof(header.magic)) != 0) {
+    std::cerr << "Not a gpu-pcie-bench sample log: " << path << "\n";
+    return 1;
+  }
+  if (header.version != 1) {
+    std::cerr << "Unsupported sample log version " << header.version << "\n";
+    return 1;
+  }
+  in.seekg(header.headerSize);
+
+  uint64_t remaining = header.committed;
+  auto byte = [&](unsigned char& b) {
+    int c = remaining > 0 ? in.get() : EOF;
+    if (c == EOF) return false;
+    --remaining;
+    b = static_cast<unsigned char>(c);
+    return true;
+  };
+  auto varint = [&](uint64_t& v) {
+    v = 0;
+    unsigned char b = 0x80;
+    for (int shift = 0; b & 0x80; shift += 7) {
+      if (shift > 63 || !byte(b)) return false;
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    }
+    return true;
+  };
+
+  out << "unix_time_ns,elapsed_ns,size_bytes,direction,wait_mode,load_threads,pass,wall_ns,device_ns\n";
+  uint64_t timestamp = 0, size = 0, load = 0, records = 0;
+  unsigned char flags;
+  while (byte(flags)) {
+    uint64_t delta, wall, device = 0;
+    if (!varint(delta) || ((flags & 0x10) && !varint(size)) || ((flags & 0x40) && !varint(load)) ||
+        !varint(wall) || ((flags & 0x20) && !varint(device))) {
+      std::cerr << "Truncated record " << records << " in " << path << "\n";
+      return 1;
+    }
+    timestamp += delta;
+    out << header.startUnixNs + timestamp << "," << timestamp << "," << size << ","
+        << ((flags & 1) ? "dev2host" : "host2dev") << "," << wait_mode_name(static_cast<WaitMode>((flags >> 1) & 7))
+        << "," << load << "," << ((flags & 0x80) ? "baseline" : "measured") << "," << wall << ",";
+    if (flags & 0x20) out << device;
+    out << "\n";
+    ++records;
+  }
+  if (records != header.records) {
+    std::cerr << "Warning: " << path << " header lists " << header.records << " records, decoded " << records
+              << "\n";
+  }
+  return 0;
+}
+
+// Transfer timeline for --trace in Chrome trace-event JSON (chrome://tracing,
+// ui.perfetto.dev): per submitting thread a track with the enqueue call and
+// the wait, per command queue a track with the profiled device execution,
+// linked by flow arrows. Global like transferClock because measure() also
+// runs on the contention threads, which have no Instruments.
+//
+// OpenCL 1.2 has no host/device timer correlation, so each queue's device
+// timestamps are shifted by the smallest offset that puts every command's
+// QUEUED time at or after its enqueue call started.
+struct Tracer {
+  static const size_t maxTransfers = 200000;
+
+  struct Transfer {
+    Sample sample;
+    size_t size;
+    bool write;
+    WaitMode mode;
+    int thread, queue;
+  };
+
+  bool enabled = false;
+  std::mutex mutex;
+  std::vector<Transfer> transfers;
+  std::vector<std::thread::id> threads;
+  std::vector<cl_command_queue> queues;
+  bool truncated = false;
+
+  template <typename T>
+  static int slot(std::vector<T>& list, const T& value) {
+    auto it = std::find(list.begin(), list.end(), value);
+    if (it != list.end()) return static_cast<int>(it - list.begin());
+    list.push_back(value);
+    return static_cast<int>(list.size() - 1);
+  }
+
+  void add(cl_command_queue queue, const Sample& sample, size_t size, bool write, WaitMode mode) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (transfers.size() >= maxTransfers) {
+      truncated = true;
+      return;
+    }
+    transfers.push_back({ sample, size, write, mode, slot(threads, std::this_thread::get_id()), slot(queues, queue) });
+  }
+
+  static const char* wait_name(WaitMode mode) {
+    switch (mode) {
+      case WaitMode::Block:
+      case WaitMode::Finish:   return "clFinish";
+      case WaitMode::Events:   return "clWaitForEvents";
+      case WaitMode::Poll:     return "poll event status";
+      case WaitMode::Callback: return "wait for callback";
+    }
+    return "wait";
+  }
+
+  bool write(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+      std::cerr << "Cannot open trace file " << path << "\n";
+      return false;
+    }
+    if (truncated) {
+      std::cerr << "Warning: trace holds the first " << maxTransfers << " transfers only\n";
+    }
+
+    std::vector<double> offsets(queues.size(), -std::numeric_limits<double>::infinity());  // ns
+    for (const Transfer& t : transfers) {
+      if (t.sample.queued == 0) continue;
+      offsets[t.queue] = std::max(offsets[t.queue], t.sample.timestamp * 1e9 - static_cast<double>(t.sample.queued));
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"tool\":\"gpu-pcie-bench\",\"version\":\"" << VERSION
+        << "\"},\"traceEvents\":[\n";
+    out << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"Host\"}},\n";
+    out << "{\"ph\":\"M\",\"pid\":2,\"name\":\"process_name\",\"args\":{\"name\":\"OpenCL queues\"}}";
+    for (size_t i = 0; i < threads.size(); ++i) {
+      out << ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"name\":\"thread_name\",\"args\":{\"name\":\""
+          << (i == 0 ? "Main thread" : "Thread " + std::to_string(i)) << "\"}}";
+    }
+    for (size_t i = 0; i < queues.size(); ++i) {
+      out << ",\n{\"ph\":\"M\",\"pid\":2,\"tid\":" << i << ",\"name\":\"thread_name\",\"args\":{\"name\":\"Queue "
+          << i << "\"}}";
+    }
+
+    uint64_t flow = 0;
+    for (const Transfer& t : transfers) {
+      const Sample& s = t.sample;
+      double begin = s.timestamp * 1e6, enqueued = begin + s.enqueueSeconds * 1e6, done = begin + s.seconds * 1e6;
+      std::string args = "{\"bytes\":" + std::to_string(t.size) + ",\"wait_mode\":\"" + wait_mode_name(t.mode) + "\"}";
+      out << ",\n{\"ph\":\"X\",\"cat\":\"enqueue\",\"name\":\""
+          << (t.write ? "clEnqueueWriteBuffer" : "clEnqueueReadBuffer") << "\",\"pid\":1,\"tid\":" << t.thread
+          << ",\"ts\":" << begin << ",\"dur\":" << enqueued - begin << ",\"args\":" << args << "}";
+      out << ",\n{\"ph\":\"X\",\"cat\":\"wait\",\"name\":\"" << wait_name(t.mode) << "\",\"pid\":1,\"tid\":"
+          << t.thread << ",\"ts\":" << enqueued << ",\"dur\":" << std::max(0.0, done - enqueued) << "}";
+      if (s.end <= s.start || s.queued == 0) continue;
+
+      double start = (s.start + offsets[t.queue]) * 1e-3, end = (s.end + offsets[t.queue]) * 1e-3;
+      out << ",\n{\"ph\":\"X\",\"cat\":\"device\",\"name\":\"" << (t.write ? "H2D " : "D2H ") << format_size(t.size)
+          << "\",\"pid\":2,\"tid\":" << t.queue << ",\"ts\":" << start << ",\"dur\":" << end - start
+          << ",\"args\":{\"bytes\":" << t.size << ",\"queued_to_start_us\":" << (s.start - s.queued) * 1e-3 << "}}";
+      out << ",\n{\"ph\":\"s\",\"cat\":\"transfer\",\"name\":\"transfer\",\"id\":" << flow << ",\"pid\":1,\"tid\":"
+          << t.thread << ",\"ts\":" << begin << "}";
+      out << ",\n{\"ph\":\"f\",\"bp\":\"e\",\"cat\":\"transfer\",\"name\":\"transfer\",\"id\":" << flow
+          << ",\"pid\":2,\"tid\":" << t.queue << ",\"ts\":" << start << "}";
+      ++flow;
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+  }
+};
+
+Tracer tracer;
+
+// Runtime probes wrapped around every measured transfer.
+struct Instruments {
+  PerfSession perf;
+  Watchdog watchdog;
+  SensorSampler sensors;
+  EnergyMeter energy;
+  LinkMonitor link;
+  Verifier verify;
+  SampleLog samples;
+};
+
+// System-wide context read from /proc before a transfer and again after a
+// stall, so the delta covers exactly the slow iteration.
+struct SystemSnapshot {
+  std::map<std::string, uint64_t> interrupts;  // "LOC (Local timer interrupts)" -> sum over CPUs
+  std::string loadavg;
+  int runQueue = 0;
+  uint64_t pageFaults = 0;
+  uint64_t majorFaults = 0;
+};
+
+#ifdef _WIN32
+SystemSnapshot read_system_snapshot() {
+  return SystemSnapshot();
+}
+#else
+SystemSnapshot read_system_snapshot() {
+  SystemSnapshot snap;
+  std::string line;
+
+  std::ifstream interrupts("/proc/interrupts");
+  std::getline(interrupts, line);  // CPU header
+  while (std::getline(interrupts, line)) {
+    std::istringstream ls(line);
+    std::string id, token;
+    ls >> id;
+    if (id.empty() || id.back() != ':') continue;
+    id.pop_back();
+    uint64_t total = 0;
+    std::string description;
+    while (ls >> token) {
+      if (!token.empty() && std::all_of(token.begin(), token.end(), ::isdigit)) {
+        total += std::stoull(token);
+      } else {
+        std::getline(ls, description);
+        description = token + description;
+        break;
+      }
+    }
+    snap.interrupts[description.empty() ? id : id + " (" + description + ")"] = total;
+  }
+
+  std::ifstream loadavg("/proc/loadavg");
+  std::getline(loadavg, line);
+  std::istringstream ls(line);
+  std::string l1, l5, l15, tasks;
+  ls >> l1 >> l5 >> l15 >> tasks;
+  snap.loadavg = l1 + " " + l5 + " " + l15;
+  snap.runQueue = atoi(tasks.c_str());  // "running/total"
+
+  std::ifstream vmstat("/proc/vmstat");
+  std::string key;
+  uint64_t value;
+  while (vmstat >> key >> value) {
+    if (key == "pgfault") snap.pageFaults = value;
+    else if (key == "pgmajfault") snap.majorFaults = value;
+  }
+  return snap;
+}
+#endif
+
+struct Stall {
+  int iteration = 0;
+  Sample sample;
+  double median = 0;
+  std::string loadavg;
+  int runQueue = 0;
+  uint64_t pageFaults = 0;
+  uint64_t majorFaults = 0;
+  std::vector<std::pair<std::string, uint64_t>> interrupts;  // largest deltas first
+};
+
+// Flags samples slower than factor x the running median of earlier samples.
+struct StallDetector {
+  static const size_t warmup = 5;
+  std::vector<double> sorted;
+  SystemSnapshot before;
+
+  bool enabled(const Options& opts) const { return opts.stallFactor > 0; }
+
+  void begin(const Options& opts) {
+    if (enabled(opts)) before = read_system_snapshot();
+  }
+
+  void end(const Options& opts, int iteration, const Sample& sample, std::vector<Stall>& stalls) {
+    if (!enabled(opts)) return;
+    if (sorted.size() >= warmup) {
+      double median = sorted[sorted.size() / 2];
+      if (sample.seconds > opts.stallFactor * median) {
+        stalls.push_back(capture(iteration, sample, median));
+      }
+    }
+    sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), sample.seconds), sample.seconds);
+  }
+
+  Stall capture(int iteration, const Sample& sample, double median) const {
+    SystemSnapshot after = read_system_snapshot();
+    Stall stall;
+    stall.iteration = iteration;
+    stall.sample = sample;
+    stall.median = median;
+    stall.loadavg = after.loadavg;
+    stall.runQueue = after.runQueue;
+    stall.pageFaults = after.pageFaults - before.pageFaults;
+    stall.majorFaults = after.majorFaults - before.majorFaults;
+    for (const auto& irq : after.interrupts) {
+      auto it = before.interrupts.find(irq.first);
+      uint64_t prev = (it != before.interrupts.end()) ? it->second : 0;
+      if (irq.second > prev) stall.interrupts.emplace_back(irq.first, irq.second - prev);
+    }
+    std::sort(stall.interrupts.begin(), stall.interrupts.end(),
+              [](const auto& a, const auto& b) { return a.second > b.second; });
+    if (stall.interrupts.size() > 5) stall.interrupts.resize(5);
+    return stall;
+  }
+};
+
+// Streaming two-sided CUSUM over per-iteration bandwidth. Each regime learns
+// its level and robust spread (MAD) from its first values; a shift is flagged
+// once the cumulative deviation exceeds the threshold and dated back to where
+// the statistic last left zero. The allowed drift is tuned to shifts of at
+// least minShift of the level, and per-value deviations are clipped so a
+// single stall cannot trigger a change on its own. A flagged shift is only
+// reported once the level learned after it confirms it, which filters out
+// bursts shorter than the learning window.
+struct ChangePointDetector {
+  struct ChangePoint {
+    double timestamp = 0;
+    uint64_t index = 0;
+    double before = 0;
+    double after = 0;
+  };
+
+  size_t learn = 30;
+  double minShift = 0.05;   // relative to the level
+  double threshold = 8;     // in sigma
+
+  std::vector<double> warmup;
+  double level = 0, sigma = 0;
+  double drift = 0, clip = 0;  // in sigma
+  uint64_t index = 0;
+  bool pending = false;
+  ChangePoint candidate;
+  struct Side {
+    double sum = 0;
+    uint64_t startIndex = 0;
+    double startTime = 0;
+  } up, down;
+
+  // Returns true and fills cp when a change is confirmed by this value.
+  bool add(double timestamp, double value, ChangePoint& cp) {
+    uint64_t i = index++;
+    if (warmup.size() < learn) {
+      warmup.push_back(value);
+      if (warmup.size() < learn) return false;
+      learn_level();
+      if (!pending) return false;
+      pending = false;
+      if (std::abs(level / candidate.before - 1) < minShift) return false;
+      cp = candidate;
+      cp.after = level;
+      return true;
+    }
+
+    double z = std::max(-clip, std::min(clip, (value - level) / sigma));
+    bool upChange = step(up, z - drift, i, timestamp);
+    bool downChange = step(down, -z - drift, i, timestamp);
+    if (!upChange && !downChange) return false;
+
+    const Side& side = upChange ? up : down;
+    pending = true;
+    candidate.timestamp = side.startTime;
+    candidate.index = side.startIndex;
+    candidate.before = level;
+    warmup.clear();
+    up = Side();
+    down = Side();
+    return false;
+  }
+
+  bool step(Side& side, double increment, uint64_t i, double timestamp) {
+    if (side.sum <= 0) {
+      side = Side();
+      side.startIndex = i;
+      side.startTime = timestamp;
+    }
+    side.sum = std::max(0.0, side.sum + increment);
+    return side.sum > threshold;
+  }
+
+  void learn_level() {
+    std::vector<double> v = warmup;
+    std::sort(v.begin(), v.end());
+    level = v[v.size() / 2];
+    for (double& x : v) x = std::abs(x - level);
+    std::sort(v.begin(), v.end());
+    sigma = std::max(1.4826 * v[v.size() / 2], 1e-3 * std::abs(level));
+    if (sigma <= 0) sigma = 1e-12;
+    drift = std::max(0.5, 0.5 * minShift * std::abs(level) / sigma);
+    clip = drift + 3;
+  }
+};
+
+struct DirectionStats {
+  std::vector<Sample> samples;
+  CpuUsage cpu;
+  PerfCounts perf;
+  std::vector<Stall> stalls;
+  std::vector<ChangePointDetector::ChangePoint> changePoints;
+  std::vector<SensorSample> sensors;  // samples taken while this direction was running
+  std::vector<double> energy;          // joules per EnergyMeter domain
+};
+
+struct NoiseFloor {
+  double marker = 0;            // marker command, enqueue to completion
+  double finish = 0;            // clFinish on an idle queue
+  double write1 = 0, read1 = 0; // 1-byte transfers
+};
+
+struct PassResult {
+  WaitMode mode = WaitMode::Block;
+  DirectionStats h2d;
+  DirectionStats d2h;
+  NoiseFloor floor;
+  uint64_t sensorsDropped = 0;  // sensor samples lost to a full ring during the pass
+};
+
+struct CallbackState {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+};
+
+void CL_CALLBACK on_transfer_complete(cl_event, cl_int, void* userData) {
+  auto* state = static_cast<CallbackState*>(userData);
+  // Notify under the lock: the waiter owns the state and may destroy it as
+  // soon as it observes done == true.
+  std::lock_guard<std::mutex> lock(state->mutex);
+  state->done = true;
+  state->cv.notify_one();
+}
+
+cl_int wait_for_transfer(cl_command_queue queue, cl_event event, WaitMode mode) {
+  switch (mode) {
+    case WaitMode::Block:
+    case WaitMode::Finish:
+      return clFinish(queue);
+    case WaitMode::Events:
+      return clWaitForEvents(1, &event);
+    case WaitMode::Poll: {
+      cl_int status = clFlush(queue);
+      cl_int execStatus = CL_QUEUED;
+      while (status == CL_SUCCESS && execStatus > CL_COMPLETE) {
+        status = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(execStatus), &execStatus, nullptr);
+      }
+      return status != CL_SUCCESS ? status : execStatus;
+    }
+    case WaitMode::Callback: {
+      CallbackState state;
+      cl_int status = clSetEventCallback(event, CL_COMPLETE, on_transfer_complete, &state);
+      if (status != CL_SUCCESS) return status;
+      // Once registered, the callback will write to state: never return before
+      // it ran. clWaitForEvents flushes implicitly if clFlush failed, and the
+      // callback also runs when the command terminates with an error.
+      status = clFlush(queue);
+      if (status != CL_SUCCESS) clWaitForEvents(1, &event);
+      std::unique_lock<std::mutex> lock(state.mutex);
+      state.cv.wait(lock, [&] { return state.done; });
+      return status;
+    }
+  }
+  return CL_INVALID_VALUE;
+}
+
+int measure(cl_command_queue queue, cl_mem deviceBuf, void* hostPtr, size_t size, bool write,
+            WaitMode mode, Sample& sample, size_t deviceOffset = 0) {
+  cl_bool blocking = (mode == WaitMode::Block) ? CL_TRUE : CL_FALSE;
+  cl_event event = nullptr;
+  double timestamp = elapsed_seconds();
+  uint64_t start = read_clock(transferClock.source);
+  cl_int status = write ?
+    clEnqueueWriteBuffer(queue, deviceBuf, blocking, deviceOffset, size, hostPtr, 0, nullptr, &event) :
+    clEnqueueReadBuffer(queue, deviceBuf, blocking, deviceOffset, size, hostPtr, 0, nullptr, &event);
+  CHECK(status, write ? "Write failed" : "Read failed");
+  uint64_t enqueued = tracer.enabled ? read_clock(transferClock.source) : 0;
+  status = wait_for_transfer(queue, event, mode);
+  uint64_t end = read_clock(transferClock.source);
+  if (status != CL_SUCCESS) clReleaseEvent(event);
+  CHECK(status, write ? "Waiting for write failed" : "Waiting for read failed");
+
+  sample = Sample();
+  sample.timestamp = timestamp;
+  sample.seconds = clock_seconds(start, end);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &sample.queued, nullptr);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &sample.submit, nullptr);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &sample.start, nullptr);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &sample.end, nullptr);
+  clReleaseEvent(event);
+  if (tracer.enabled) {
+    sample.enqueueSeconds = clock_seconds(start, enqueued);
+    tracer.add(queue, sample, size, write, mode);
+  }
+  return 0;
+}
+
+double to_bandwidth(size_t bytes, double sec, Unit unit) {
+  if (unit == Unit::GBps) return bytes / (sec * 1024.0 * 1024.0 * 1024.0);
+  else                    return bytes / (sec * 1024.0 * 1024.0);
+}
+
+const char* unit_label(Unit unit) {
+  return (unit == Unit::GBps) ? "GB/s" : "MB/s";
+}
+
+// Attributes each sensor sample to the direction whose transfer started most
+// recently before it was taken.
+void assign_sensor_samples(const std::vector<SensorSample>& samples, PassResult& result) {
+  auto lastStart = [](const DirectionStats& stats, double t) {
+    auto it = std::upper_bound(stats.samples.begin(), stats.samples.end(), t,
+                               [](double v, const Sample& s) { return v < s.timestamp; });
+    return it == stats.samples.begin() ? -1.0 : std::prev(it)->timestamp;
+  };
+  for (const SensorSample& ss : samples) {
+    double h2d = lastStart(result.h2d, ss.timestamp), d2h = lastStart(result.d2h, ss.timestamp);
+    if (h2d < 0 && d2h < 0) continue;
+    (h2d >= d2h ? result.h2d : result.d2h).sensors.push_back(ss);
+  }
+}
+
+int run_pass(cl_command_queue queue, cl_mem deviceBuffer, void* hostPtr, void* recvPtr, size_t dataSize,
+             const Options& opts, WaitMode mode, Instruments& inst, PassResult& result) {
+  result = PassResult();
+  result.mode = mode;
+  result.h2d.samples.reserve(opts.rounds);
+  result.d2h.samples.reserve(opts.rounds);
+
+  StallDetector h2dStalls, d2hStalls;
+  ChangePointDetector h2dShifts, d2hShifts;
+
+  std::vector<SensorSample> stale, sensorSamples;
+  inst.sensors.drain(stale);
+  uint64_t droppedBefore = inst.sensors.dropped.load();
+  std::vector<double> energyBefore, energyAfter;
+
+  auto runOne = [&](int iteration, void* ptr, bool write, DirectionStats& stats, StallDetector& stalls,
+                    ChangePointDetector& shifts) {
+    Sample sample;
+    if (inst.sensors.running()) {
+      // Drain between transfers so long passes don't overflow the ring.
+      inst.sensors.drain(sensorSamples);
+      inst.sensors.note_cpu();
+    }
+    stalls.begin(opts);
+    CpuUsage cpuBefore = cpu_usage_now();
+    if (inst.energy.available()) inst.energy.read(energyBefore);
+    inst.perf.begin();
+    inst.watchdog.arm(write, dataSize);
+    int failed = measure(queue, deviceBuffer, ptr, dataSize, write, mode, sample);
+    inst.watchdog.disarm();
+    inst.perf.end(stats.perf);
+    inst.link.poll();
+    if (inst.energy.available()) {
+      inst.energy.read(energyAfter);
+      inst.energy.accumulate(energyBefore, energyAfter, stats.energy);
+    }
+    stats.cpu += cpu_usage_now() - cpuBefore;
+    if (failed) return failed;
+    stalls.end(opts, iteration, sample, stats.stalls);
+    ChangePointDetector::ChangePoint cp;
+    if (opts.changePoints && shifts.add(sample.timestamp, to_bandwidth(dataSize, sample.seconds, opts.unit), cp)) {
+      stats.changePoints.push_back(cp);
+    }
+    stats.samples.push_back(sample);
+    inst.samples.add(sample, dataSize, write, mode);
+    return 0;
+  };
+
+  for (int i = 0; i < opts.rounds; ++i) {
+    if (!opts.stabilize) std::cout << "\r  Iteration " << (i + 1) << "/" << opts.rounds << std::flush;
+
+    if (opts.direction == Direction::HostToDevice || opts.direction == Direction::Both) {
+      if (runOne(i, hostPtr, true, result.h2d, h2dStalls, h2dShifts)) return 1;
+    }
+
+    if (opts.direction == Direction::DeviceToHost || opts.direction == Direction::Both) {
+      if (inst.verify.enabled && inst.verify.everyTransfer) memset(recvPtr, 0xA5, dataSize);
+      if (runOne(i, recvPtr, false, result.d2h, d2hStalls, d2hShifts)) return 1;
+      if (inst.verify.enabled && inst.verify.everyTransfer) {
+        inst.verify.check(recvPtr, std::string(wait_mode_name(mode)) + ", read " + std::to_string(i + 1));
+      }
+    }
+  }
+
+  if (opts.stabilize) std::cout << "  Iteration " << opts.rounds << "/" << opts.rounds;
+  std::cout << std::endl;
+  if (inst.sensors.running()) {
+    inst.sensors.drain(sensorSamples);
+    assign_sensor_samples(sensorSamples, result);
+    result.sensorsDropped = inst.sensors.dropped.load() - droppedBefore;
+  }
+  return 0;
+}
+
+struct Summary {
+  double avg = 0, min = 0, max = 0;
+  double p50 = 0, p90 = 0, p99 = 0;
+  double deviceP50 = 0;  // profiled execution time, 0 if unavailable
+  double cpuPerTransfer = 0;
+  double threadCpuPerTransfer = 0;
+  double cpuPerGB = 0;
+  double voluntaryPerTransfer = 0;
+  double involuntaryPerTransfer = 0;
+};
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t idx = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+Summary summarize(const DirectionStats& stats, size_t dataSize) {
+  Summary s;
+  if (stats.samples.empty()) return s;
+
+  std::vector<double> times, deviceTimes;
+  for (const Sample& sample : stats.samples) {
+    times.push_back(sample.seconds);
+    if (sample.end > sample.start) deviceTimes.push_back((sample.end - sample.start) * 1e-9);
+  }
+  std::sort(times.begin(), times.end());
+  std::sort(deviceTimes.begin(), deviceTimes.end());
+
+  double sum = 0;
+  for (double t : times) sum += t;
+  s.avg = sum / times.size();
+  s.min = times.front();
+  s.max = times.back();
+  s.p50 = percentile(times, 0.50);
+  s.p90 = percentile(times, 0.90);
+  s.p99 = percentile(times, 0.99);
+  s.deviceP50 = percentile(deviceTimes, 0.50);
+  double gigabytes = static_cast<double>(dataSize) * times.size() / (1024.0 * 1024.0 * 1024.0);
+  s.cpuPerTransfer = stats.cpu.process / times.size();
+  s.threadCpuPerTransfer = stats.cpu.thread / times.size();
+  s.cpuPerGB = stats.cpu.process / gigabytes;
+  s.voluntaryPerTransfer = stats.cpu.voluntary / times.size();
+  s.involuntaryPerTransfer = stats.cpu.involuntary / times.size();
+  return s;
+}
+
+// In-place radix-2 FFT; a.size() must be a power of two.
+void fft(std::vector<std::complex<double>>& a, bool inverse) {
+  const double pi = std::acos(-1.0);
+  size_t n = a.size();
+  for (size_t i = 1, j = 0; i < n; ++i) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) std::swap(a[i], a[j]);
+  }
+  for (size_t len = 2; len <= n; len <<= 1) {
+    double angle = 2 * pi / len * (inverse ? 1 : -1);
+    std::complex<double> step(std::cos(angle), std::sin(angle));
+    for (size_t i = 0; i < n; i += len) {
+      std::complex<double> w(1);
+      for (size_t j = 0; j < len / 2; ++j) {
+        std::complex<double> u = a[i + j], v = a[i + j + len / 2] * w;
+        a[i + j] = u + v;
+        a[i + j + len / 2] = u - v;
+        w *= step;
+      }
+    }
+  }
+  if (inverse) {
+    for (auto& x : a) x /= static_cast<double>(n);
+  }
+}
+
+struct Period {
+  double iterations = 0;
+  double seconds = 0;      // iterations x mean time between samples
+  double amplitude = 0;    // of the sinusoidal component, in seconds
+  double correlation = 0;  // autocorrelation at the period lag
+};
+
+// Finds up to maxPeriods dominant periods in the sample durations. A spectral
+// peak must stand well above the median power, be no longer than half the
+// series, correlate with itself at its lag, and not be a harmonic of a period
+// already reported.
+std::vector<Period> find_periods(const std::vector<Sample>& samples, size_t maxPeriods = 3) {
+  std::vector<Period> result;
+  size_t n = samples.size();
+  if (n < 32) return result;
+
+  double mean = 0;
+  for (const Sample& s : samples) mean += s.seconds;
+  mean /= n;
+
+  size_t m = 1;
+  while (m < 2 * n) m <<= 1;  // zero padding makes the autocorrelation linear
+  std::vector<std::complex<double>> spectrum(m);
+  for (size_t i = 0; i < n; ++i) spectrum[i] = samples[i].seconds - mean;
+  fft(spectrum, false);
+
+  std::vector<double> power(m / 2);
+  for (size_t k = 0; k < m / 2; ++k) power[k] = std::norm(spectrum[k]);
+
+  std::vector<std::complex<double>> acf(m);
+  for (size_t k = 0; k < m; ++k) acf[k] = std::norm(spectrum[k]);
+  fft(acf, true);
+  if (acf[0].real() <= 0) return result;
+
+  std::vector<double> sortedPower(power.begin() + 1, power.end());
+  std::sort(sortedPower.begin(), sortedPower.end());
+  double threshold = 8 * sortedPower[sortedPower.size() / 2];
+
+  size_t minBin = (2 * m + n - 1) / n;  // period <= n / 2
+  std::vector<size_t> peaks;
+  for (size_t k = std::max<size_t>(minBin, 1); k + 1 < m / 2; ++k) {
+    if (power[k] > threshold && power[k] >= power[k - 1] && power[k] > power[k + 1]) peaks.push_back(k);
+  }
+
+  // Rank by autocorrelation at the peak's lag: a spike train has equally strong
+  // spectral harmonics, but only its true period correlates with itself.
+  auto correlationAt = [&](size_t k) {
+    size_t lag = static_cast<size_t>(std::round(static_cast<double>(m) / k));
+    return lag < m ? acf[lag].real() / acf[0].real() : 0.0;
+  };
+  std::sort(peaks.begin(), peaks.end(), [&](size_t a, size_t b) { return correlationAt(a) > correlationAt(b); });
+
+  double interval = (samples.back().timestamp - samples.front().timestamp) / (n - 1);
+  for (size_t k : peaks) {
+    double period = static_cast<double>(m) / k;
+    double correlation = correlationAt(k);
+    if (correlation < 0.1) break;
+    bool harmonic = false;
+    for (const Period& p : result) {
+      double ratio = p.iterations / period;
+      if (std::abs(ratio - std::round(ratio)) < 0.05 * ratio) harmonic = true;
+    }
+    if (harmonic) continue;
+
+    Period p;
+    p.iterations = period;
+    p.seconds = period * interval;
+    p.amplitude = 2 * std::abs(spectrum[k]) / n;
+    p.correlation = correlation;
+    result.push_back(p);
+    if (result.size() >= maxPeriods) break;
+  }
+  return result;
+}
+
+void print_perf(const PerfSession& perf, const DirectionStats& stats) {
+  if (!perf.available() || stats.samples.empty()) return;
+  double n = static_cast<double>(stats.samples.size());
+  std::cout << "  Perf (per transfer):";
+  const char* sep = " ";
+  for (int i = 0; i < PerfCounterCount; ++i) {
+    if (!perf.has(i)) continue;
+    std::cout << sep << perfCounterNames[i] << " " << stats.perf.value[i] / n;
+    sep = ", ";
+  }
+  if (perf.has(PerfCycles) && perf.has(PerfInstructions) && stats.perf.value[PerfCycles] > 0) {
+    std::cout << sep << "IPC " << stats.perf.value[PerfInstructions] / stats.perf.value[PerfCycles];
+  }
+  std::cout << "\n";
+}
+
+struct SensorRange {
+  std::string label;
+  const char* unit;
+  double min, avg, max;
+};
+
+// Min / avg / max of the submitting core's frequency and of each sensor.
+std::vector<SensorRange> sensor_ranges(const SensorSampler& sampler, const std::vector<SensorSample>& samples) {
+  std::vector<SensorRange> ranges;
+  if (samples.empty()) return ranges;
+  auto add = [&](const std::string& label, const char* unit, auto get) {
+    double lo = 1e300, hi = -1e300, sum = 0;
+    for (const SensorSample& s : samples) {
+      double v = get(s);
+      lo = std::min(lo, v);
+      hi = std::max(hi, v);
+      sum += v;
+    }
+    ranges.push_back({ label, unit, lo, sum / samples.size(), hi });
+  };
+  add("cpu freq", "MHz", [](const SensorSample& s) { return s.cpuFreqMHz; });
+  for (size_t i = 0; i < sampler.sensors.size(); ++i) {
+    add(sampler.sensors[i].label, sampler.sensors[i].unit, [i](const SensorSample& s) { return s.value[i]; });
+  }
+  return ranges;
+}
+
+void print_sensors(const SensorSampler& sampler, const std::vector<SensorSample>& samples) {
+  if (!sampler.running()) return;
+  if (samples.empty()) {
+    std::cout << "  Sensors: no samples (run shorter than the sampling interval)\n";
+    return;
+  }
+  std::cout << "  Sensors (min / avg / max over " << samples.size() << " samples):\n";
+  std::vector<SensorRange> ranges = sensor_ranges(sampler, samples);
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    std::string label = ranges[i].label;
+    if (i == 0) label += " (cpu " + std::to_string(samples.back().cpu) + ")";
+    std::cout << "    " << std::left << std::setw(24) << label << std::right << ranges[i].min << " / "
+              << ranges[i].avg << " / " << ranges[i].max << " " << ranges[i].unit << "\n";
+  }
+}
+
+// One-line sensor readout of the sample closest to t.
+void print_sensor_snapshot(const SensorSampler& sampler, const std::vector<SensorSample>& samples, double t) {
+  if (samples.empty()) return;
+  auto nearest = std::min_element(samples.begin(), samples.end(), [t](const SensorSample& a, const SensorSample& b) {
+    return std::abs(a.timestamp - t) < std::abs(b.timestamp - t);
+  });
+  std::cout << "      sensors at t=" << std::setprecision(3) << nearest->timestamp << std::setprecision(2)
+            << "s: cpu" << nearest->cpu << " " << nearest->cpuFreqMHz << " MHz";
+  for (size_t i = 0; i < sampler.sensors.size(); ++i) {
+    std::cout << ", " << sampler.sensors[i].label << " " << nearest->value[i] << " " << sampler.sensors[i].unit;
+  }
+  std::cout << "\n";
+}
+
+double busy_seconds(const DirectionStats& stats) {
+  double busy = 0;
+  for (const Sample& s : stats.samples) busy += s.seconds;
+  return busy;
+}
+
+// Joules per RAPL domain and GPU power sensor spent on the direction's
+// transfers; sensors count their average power over the busy time.
+std::vector<std::pair<std::string, double>> energy_joules(const Instruments& inst, const DirectionStats& stats) {
+  double busy = busy_seconds(stats);
+  std::vector<std::pair<std::string, double>> joules;
+  for (size_t i = 0; i < inst.energy.domains.size() && i < stats.energy.size(); ++i) {
+    joules.emplace_back(inst.energy.domains[i].label, stats.energy[i]);
+  }
+  if (!stats.sensors.empty()) {
+    for (size_t i = 0; i < inst.sensors.sensors.size(); ++i) {
+      if (std::string(inst.sensors.sensors[i].unit) != "W") continue;
+      double sum = 0;
+      for (const SensorSample& ss : stats.sensors) sum += ss.value[i];
+      joules.emplace_back(inst.sensors.sensors[i].label, sum / stats.sensors.size() * busy);
+    }
+  }
+  return joules;
+}
+
+// Energy per GB from the counters read around each transfer, plus GPU power
+// sensors integrated over the direction's busy time.
+void print_energy(const Instruments& inst, const DirectionStats& stats, size_t dataSize, const Options& opts) {
+  if (!opts.energy || stats.samples.empty()) return;
+  double busy = busy_seconds(stats);
+  double gigabytes = static_cast<double>(dataSize) * stats.samples.size() / (1024.0 * 1024.0 * 1024.0);
+  std::vector<std::pair<std::string, double>> joules = energy_joules(inst, stats);
+  if (joules.empty()) return;
+
+  std::cout << "  Energy:";
+  const char* sep = " ";
+  for (const auto& j : joules) {
+    std::cout << sep << j.first << " " << j.second / gigabytes << " J/GB (" << j.second / busy << " W)";
+    sep = ", ";
+  }
+  std::cout << "\n";
+}
+
+void print_link_efficiency(const LinkBudget& budget, const DirectionStats& stats, size_t dataSize, Unit unit) {
+  if (!budget.valid || stats.samples.empty()) return;
+  Summary s = summarize(stats, dataSize);
+  double avg = dataSize / s.avg, best = dataSize / s.min;
+  std::cout << "  Link efficiency: avg " << avg / budget.payloadBytesPerSec * 100 << "%, best "
+            << best / budget.payloadBytesPerSec * 100 << "% of " << to_bandwidth(1, 1 / budget.payloadBytesPerSec, unit)
+            << " " << unit_label(unit) << "\n";
+}
+
+void print_stalls(const DirectionStats& stats, const Options& opts, const Instruments& inst) {
+  const std::vector<Stall>& stalls = stats.stalls;
+  if (opts.stallFactor <= 0) return;
+  std::cout << "  Stalls (> " << opts.stallFactor << "x running median): " << stalls.size() << "\n";
+  for (const Stall& stall : stalls) {
+    const Sample& s = stall.sample;
+    std::cout << "    t=" << std::setprecision(3) << s.timestamp << "s" << std::setprecision(2)
+              << " iter " << (stall.iteration + 1) << ": " << s.seconds * 1e6 << " us ("
+              << s.seconds / stall.median << "x median " << stall.median * 1e6 << " us)";
+#ifndef _WIN32
+    std::cout << ", load " << stall.loadavg << ", runq " << stall.runQueue
+              << ", faults +" << stall.pageFaults << " (major +" << stall.majorFaults << ")";
+#endif
+    std::cout << "\n";
+    if (s.end > s.start && s.start >= s.submit && s.submit >= s.queued) {
+      std::cout << "      profile: queued->submit " << (s.submit - s.queued) * 1e-3
+                << " us, submit->start " << (s.start - s.submit) * 1e-3
+                << " us, exec " << (s.end - s.start) * 1e-3 << " us\n";
+    }
+    if (!stall.interrupts.empty()) {
+      std::cout << "      irqs:";
+      const char* sep = " ";
+      for (const auto& irq : stall.interrupts) {
+        std::cout << sep << irq.first << " +" << irq.second;
+        sep = ", ";
+      }
+      std::cout << "\n";
+    }
+    print_sensor_snapshot(inst.sensors, stats.sensors, s.timestamp);
+  }
+}
+
+void print_periods(const std::vector<Sample>& samples, const Options& opts) {
+  if (!opts.periodicity) return;
+  if (samples.size() < 32) {
+    std::cout << "  Periodicity: too few samples (need at least 32 rounds)\n";
+    return;
+  }
+  std::vector<Period> periods = find_periods(samples);
+  if (periods.empty()) {
+    std::cout << "  Periodicity: none detected\n";
+    return;
+  }
+  for (const Period& p : periods) {
+    std::cout << "  Periodicity: every " << p.iterations << " iterations (" << p.seconds * 1e3
+              << " ms), amplitude " << p.amplitude * 1e6 << " us, autocorrelation " << p.correlation << "\n";
+  }
+}
+
+void print_change_points(const std::vector<ChangePointDetector::ChangePoint>& changePoints, const Options& opts) {
+  if (!opts.changePoints) return;
+  if (changePoints.empty()) {
+    std::cout << "  Change points: none\n";
+    return;
+  }
+  for (const auto& cp : changePoints) {
+    std::cout << "  Change point: t=" << std::setprecision(3) << cp.timestamp << std::setprecision(2)
+              << "s iter " << (cp.index + 1) << ": " << cp.before << " -> " << cp.after << " "
+              << unit_label(opts.unit) << " (" << (cp.after / cp.before - 1) * 100 << "%)\n";
+  }
+}
+
+// A floor > 0 adds latency and bandwidth with the harness floor subtracted.
+void print_direction(const char* title, const DirectionStats& stats, size_t dataSize, Unit unit, double floor) {
+  Summary s = summarize(stats, dataSize);
+  const char* label = unit_label(unit);
+  std::cout << title << ":\n";
+  std::cout << "  Avg: " << to_bandwidth(dataSize, s.avg, unit) << " " << label << "\n";
+  std::cout << "  Min: " << to_bandwidth(dataSize, s.max, unit) << " " << label << "\n";
+  std::cout << "  Max: " << to_bandwidth(dataSize, s.min, unit) << " " << label << "\n";
+  std::cout << "  Latency: p50 " << s.p50 * 1e6 << " us, p90 " << s.p90 * 1e6
+            << " us, p99 " << s.p99 * 1e6 << " us";
+  if (s.deviceP50 > 0) std::cout << " (device p50 " << s.deviceP50 * 1e6 << " us)";
+  std::cout << "\n";
+  if (floor > 0) {
+    std::cout << "  Minus floor (" << floor * 1e6 << " us): p50 " << (s.p50 - floor) * 1e6 << " us, avg ";
+    if (s.avg > floor) std::cout << to_bandwidth(dataSize, s.avg - floor, unit) << " " << label << "\n";
+    else std::cout << "below floor\n";
+  }
+  std::cout << "  Timer: " << clock_source_name(transferClock.source) << ", 2 reads of "
+            << transferClock.readNs << " ns per sample (" << 2 * transferClock.readNs * 1e-9 / s.p50 * 100
+            << "% of p50)\n";
+  std::cout << "  Host CPU: " << s.cpuPerTransfer * 1e6 << " us/transfer (thread "
+            << s.threadCpuPerTransfer * 1e6 << " us), " << s.cpuPerGB * 1e6 << " us/GB\n";
+#ifndef _WIN32
+  std::cout << "  Context switches: " << s.voluntaryPerTransfer << " voluntary, "
+            << s.involuntaryPerTransfer << " involuntary per transfer\n";
+#endif
+}
+
+void print_pass(const PassResult& pass, size_t dataSize, const Options& opts, const Instruments& inst) {
+  if (opts.direction == Direction::HostToDevice || opts.direction == Direction::Both) {
+    print_direction("Host to Device", pass.h2d, dataSize, opts.unit, opts.subtractFloor ? pass.floor.marker : 0);
+    print_link_efficiency(inst.link.budget, pass.h2d, dataSize, opts.unit);
+    print_perf(inst.perf, pass.h2d);
+    print_sensors(inst.sensors, pass.h2d.sensors);
+    print_energy(inst, pass.h2d, dataSize, opts);
+    print_stalls(pass.h2d, opts, inst);
+    print_periods(pass.h2d.samples, opts);
+    print_change_points(pass.h2d.changePoints, opts);
+  }
+
+  if (opts.direction == Direction::DeviceToHost || opts.direction == Direction::Both) {
+    print_direction("Device to Host", pass.d2h, dataSize, opts.unit, opts.subtractFloor ? pass.floor.marker : 0);
+    print_link_efficiency(inst.link.budget, pass.d2h, dataSize, opts.unit);
+    print_perf(inst.perf, pass.d2h);
+    print_sensors(inst.sensors, pass.d2h.sensors);
+    print_energy(inst, pass.d2h, dataSize, opts);
+    print_stalls(pass.d2h, opts, inst);
+    print_periods(pass.d2h.samples, opts);
+    print_change_points(pass.d2h.changePoints, opts);
+  }
+
+  if (pass.sensorsDropped > 0) {
+    std::cout << "  Sensors: " << pass.sensorsDropped << " samples dropped (ring full)\n";
+  }
+}
+
+std::string format_link(const LinkBudget& link) {
+  if (!link.valid) return "link unknown";
+  std::ostringstream s;
+  s << "Gen" << LinkBudget::generation(link.maxSpeed) << " x" << link.maxWidth;
+  if (link.speed > 0 && (link.width < link.maxWidth || link.speed < link.maxSpeed)) {
+    s << " (now Gen" << LinkBudget::generation(link.speed) << " x" << link.width << ")";
+  }
+  return s.str();
+}
+
+std::string format_gpu_list(const std::vector<int>& gpus) {
+  std::string s;
+  for (int gpu : gpus) s += (s.empty() ? "" : ",") + std::to_string(gpu);
+  return s;
+}
+
+void print_topology(const PciTopology& topo, const std::vector<std::string>& names, Unit unit) {
+  std::cout << "PCIe topology:\n";
+  if (topo.domains.empty()) {
+    std::cout << "  not available (no sysfs PCI paths for the GPUs)\n";
+    return;
+  }
+  std::map<std::string, std::vector<std::string>> children;
+  for (const auto& entry : topo.nodes) children[entry.second.parent].push_back(entry.first);
+
+  auto printNode = [&](auto& self, const std::string& key, int depth) -> void {
+    for (const std::string& address : children[key]) {
+      const PciTopology::Node& node = topo.nodes.at(address);
+      std::cout << std::string(2 * depth + 2, ' ') << address << "  " << format_link(node.link);
+      if (node.gpu >= 0) std::cout << "  GPU " << node.gpu << ": " << names[node.gpu];
+      for (const auto& up : topo.uplinks) {
+        if (up.address != address) continue;
+        std::cout << "  [shared by GPUs " << format_gpu_list(up.gpus);
+        if (up.link.valid) {
+          std::cout << ", " << to_bandwidth(1, 1 / up.link.payloadBytesPerSec, unit) << " " << unit_label(unit);
+        }
+        std::cout << "]";
+      }
+      std::cout << "\n";
+      self(self, address, depth + 1);
+    }
+  };
+  for (const std::string& domain : topo.domains) {
+    std::cout << "  " << domain << "\n";
+    printNode(printNode, domain, 1);
+  }
+  if (topo.uplinks.empty()) std::cout << "  No uplink is shared between GPUs\n";
+}
+
+void print_link_budget(const LinkBudget& b, Unit unit) {
+  if (!b.valid) return;
+  std::cout << "Link: PCIe Gen" << LinkBudget::generation(b.maxSpeed) << " " << std::setprecision(1) << b.maxSpeed
+            << std::setprecision(2) << " GT/s x" << b.maxWidth << " capability, MPS " << b.mps << " B"
+            << (b.mpsAssumed ? " (assumed, config space not readable)" : "") << "\n";
+  if (b.speed < b.maxSpeed || b.width < b.maxWidth) {
+    std::cout << "  Negotiated now: Gen" << LinkBudget::generation(b.speed) << " " << std::setprecision(1) << b.speed
+              << std::setprecision(2) << " GT/s x" << b.width << " (idle links train down; checked under load)\n";
+  }
+  std::cout << "  Theoretical: " << to_bandwidth(1, 1 / b.rawBytesPerSec, unit) << " " << unit_label(unit)
+            << " after encoding, " << to_bandwidth(1, 1 / b.payloadBytesPerSec, unit) << " " << unit_label(unit)
+            << " payload after TLP overhead\n";
+}
+
+// p50 latency of operations that move no (or one byte of) data through the
+// same enqueue and wait path as measure(): the floor the harness and driver
+// put under every sample.
+int measure_noise_floor(cl_context context, cl_command_queue queue, WaitMode mode, NoiseFloor& floor) {
+  const int rounds = 200;
+  cl_int status;
+  cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, 64, nullptr, &status);
+  CHECK(status, "Failed to allocate noise floor buffer");
+  unsigned char byte = 0;
+  std::vector<double> marker, finish, write1, read1;
+  auto run = [&]() {
+    Sample sample;
+    for (int i = 0; i < rounds; ++i) {
+      cl_event event = nullptr;
+      uint64_t start = read_clock(transferClock.source);
+      status = clEnqueueMarkerWithWaitList(queue, 0, nullptr, &event);
+      CHECK(status, "Marker failed");
+      status = wait_for_transfer(queue, event, mode);
+      uint64_t end = read_clock(transferClock.source);
+      clReleaseEvent(event);
+      CHECK(status, "Waiting for marker failed");
+      marker.push_back(clock_seconds(start, end));
+
+      start = read_clock(transferClock.source);
+      status = clFinish(queue);
+      end = read_clock(transferClock.source);
+      CHECK(status, "clFinish failed");
+      finish.push_back(clock_seconds(start, end));
+
+      if (measure(queue, buffer, &byte, 1, true, mode, sample)) return 1;
+      write1.push_back(sample.seconds);
+      if (measure(queue, buffer, &byte, 1, false, mode, sample)) return 1;
+      read1.push_back(sample.seconds);
+    }
+    return 0;
+  };
+  // Calibration transfers are not part of any pass; keep them out of --trace
+  bool traced = tracer.enabled;
+  tracer.enabled = false;
+  int failed = run();
+  tracer.enabled = traced;
+  clReleaseMemObject(buffer);
+  if (failed) return 1;
+
+  auto p50 = [](std::vector<double>& v) {
+    std::sort(v.begin(), v.end());
+    return percentile(v, 0.5);
+  };
+  floor.marker = p50(marker);
+  floor.finish = p50(finish);
+  floor.write1 = p50(write1);
+  floor.read1 = p50(read1);
+  return 0;
+}
+
+void print_noise_floor(const std::vector<WaitMode>& modes, const std::map<WaitMode, NoiseFloor>& floors) {
+  std::cout << "Noise floor (p50):\n";
+  for (WaitMode mode : modes) {
+    const NoiseFloor& f = floors.at(mode);
+    std::cout << "  " << wait_mode_name(mode) << ": marker " << f.marker * 1e6 << " us, idle clFinish "
+              << f.finish * 1e6 << " us, 1-byte write " << f.write1 * 1e6 << " us, 1-byte read "
+              << f.read1 * 1e6 << " us\n";
+  }
+}
+
+// Coefficient of variation of the per-iteration times.
+double time_cv(const DirectionStats& stats) {
+  if (stats.samples.size() < 2) return 0;
+  double sum = 0, sq = 0;
+  for (const Sample& s : stats.samples) sum += s.seconds;
+  double mean = sum / stats.samples.size();
+  for (const Sample& s : stats.samples) sq += (s.seconds - mean) * (s.seconds - mean);
+  return std::sqrt(sq / (stats.samples.size() - 1)) / mean;
+}
+
+void print_stabilization(const Stabilizer& stab, const PassResult& baseline, const PassResult& pass,
+                         size_t dataSize, const Options& opts) {
+  std::cout << "Stabilization: ";
+  if (stab.cpu >= 0) {
+    std::cout << "CPU " << stab.cpu << (stab.isolated ? " (isolated)" : " (not isolated)") << ", "
+              << stab.movedCount << " threads moved, " << (stab.fifo ? "SCHED_FIFO" : "normal priority") << ", "
+              << (stab.locked ? "memory locked" : "memory not locked") << "\n";
+  } else {
+    std::cout << "inactive\n";
+  }
+  for (const std::string& p : stab.problems) std::cout << "  Warning: " << p << "\n";
+
+  auto compare = [&](const char* title, const DirectionStats& before, const DirectionStats& after) {
+    if (before.samples.empty() || after.samples.empty()) return;
+    Summary b = summarize(before, dataSize), a = summarize(after, dataSize);
+    std::cout << "  " << title << ": CV " << time_cv(before) * 100 << "% -> " << time_cv(after) * 100
+              << "%, p99/p50 " << b.p99 / b.p50 << " -> " << a.p99 / a.p50 << ", avg "
+              << to_bandwidth(dataSize, b.avg, opts.unit) << " -> " << to_bandwidth(dataSize, a.avg, opts.unit)
+              << " " << unit_label(opts.unit) << "\n";
+  };
+  compare("Host to Device", baseline.h2d, pass.h2d);
+  compare("Device to Host", baseline.d2h, pass.d2h);
+}
+
+// Untimed checks after a pass: the data of the last timed read, then a round
+// trip of the reference buffer through the device into a poisoned receive
+// buffer.
+int verify_pass(cl_command_queue queue, cl_mem deviceBuffer, void* hostPtr, void* recvPtr, size_t dataSize,
+                const Options& opts, const char* what, Verifier& verify) {
+  if (!verify.enabled) return 0;
+  if (opts.direction != Direction::HostToDevice) verify.check(recvPtr, std::string(what) + ", last read");
+  memset(recvPtr, 0xA5, dataSize);
+  CHECK(clEnqueueWriteBuffer(queue, deviceBuffer, CL_TRUE, 0, dataSize, hostPtr, 0, nullptr, nullptr),
+        "Verification write failed");
+  CHECK(clEnqueueReadBuffer(queue, deviceBuffer, CL_TRUE, 0, dataSize, recvPtr, 0, nullptr, nullptr),
+        "Verification read failed");
+  verify.check(recvPtr, std::string(what) + ", round trip");
+  return 0;
+}
+
+void print_verify(const Verifier& verify) {
+  if (!verify.enabled) return;
+  std::cout << "Verify: " << (verify.failureCount ? "FAILED" : "OK") << ", " << verify.failureCount << " of "
+            << verify.checks << " checks failed (CRC32C " << verify.crcName;
+  if (verify.crcSeconds > 0) {
+    std::cout << ", " << verify.crcBytes / verify.crcSeconds / (1024.0 * 1024 * 1024) << " GB/s";
+  }
+  std::cout << ")\n";
+  for (const Verifier::Failure& f : verify.failures) {
+    std::cout << "  " << f.what << ": first mismatch at offset " << f.offset << " (0x" << std::hex << f.offset
+              << "), expected 0x" << std::setw(2) << std::setfill('0') << f.expected << ", got 0x" << std::setw(2)
+              << f.actual << std::dec << std::setfill(' ') << "\n";
+  }
+}
+
+void print_link_health(const LinkMonitor& link) {
+  if (!link.enabled()) return;
+  const LinkState& a = link.base;
+  const LinkState& b = link.last;
+  std::cout << "PCIe " << link.address << ": " << b.speed << " x" << b.width;
+  if (b.correctable >= 0) std::cout << ", AER correctable +" << link.correctable_delta();
+  if (b.nonfatal >= 0 && a.nonfatal >= 0) std::cout << ", nonfatal +" << b.nonfatal - a.nonfatal;
+  std::cout << ", link changes: " << link.changes.size() << "\n";
+  for (const auto& c : link.changes) {
+    std::cout << "  t=" << std::setprecision(3) << c.timestamp << std::setprecision(2) << "s: "
+              << c.from.speed << " x" << c.from.width << " -> " << c.to.speed << " x" << c.to.width << "\n";
+  }
+  const LinkBudget& cap = link.budget;
+  if (cap.valid && link.peakSpeed > 0 && (link.peakSpeed < cap.maxSpeed || link.peakWidth < cap.maxWidth)) {
+    std::cout << "  Warning: link stayed below its Gen" << LinkBudget::generation(cap.maxSpeed) << " x" << cap.maxWidth
+              << " capability under load (check slot, riser and power saving)\n";
+  }
+  if (link.correctable_delta() > 0) {
+    std::cout << "  Warning: correctable PCIe errors during this run (replays reduce bandwidth)\n";
+  }
+}
+
+void print_wait_comparison(const std::vector<PassResult>& passes, size_t dataSize, const Options& opts) {
+  auto printTable = [&](const char* title, bool h2d) {
+    std::cout << "Wait strategies, " << title << ":\n";
+    for (const PassResult& pass : passes) {
+      Summary s = summarize(h2d ? pass.h2d : pass.d2h, dataSize);
+      std::cout << "  " << std::left << std::setw(9) << wait_mode_name(pass.mode) << std::right
+                << " p50 " << std::setw(10) << s.p50 * 1e6 << " us"
+                << "  p99 " << std::setw(10) << s.p99 * 1e6 << " us"
+                << "  CPU " << std::setw(10) << s.cpuPerTransfer * 1e6 << " us/transfer\n";
+    }
+  };
+
+  if (opts.direction == Direction::HostToDevice || opts.direction == Direction::Both) {
+    printTable("Host to Device", true);
+  }
+
+  if (opts.direction == Direction::DeviceToHost || opts.direction == Direction::Both) {
+    printTable("Device to Host", false);
+  }
+}
+
+struct LoadLevel {
+  int threads = 0;
+  double hostBytesPerSec = 0;
+  PassResult pass;  // first wait mode
+};
+
+// PCIe bandwidth per background load level, relative to the first level.
+void print_interference(const std::vector<LoadLevel>& levels, size_t dataSize, const Options& opts,
+                        const std::string& pinning) {
+  const char* label = unit_label(opts.unit);
+  std::cout << "Background memory load (" << stream_op_name(opts.interferenceOp) << ", " << pinning << "):\n";
+  auto column = [&](const char* title, const DirectionStats& stats, const DirectionStats& base) {
+    if (stats.samples.empty() || base.samples.empty()) return;
+    double avg = summarize(stats, dataSize).avg, baseAvg = summarize(base, dataSize).avg;
+    std::cout << "  " << title << " " << to_bandwidth(dataSize, avg, opts.unit) << " " << label << " ("
+              << baseAvg / avg * 100 << "%)";
+  };
+  for (const LoadLevel& level : levels) {
+    std::cout << "  " << std::setw(3) << level.threads << " threads, host "
+              << to_bandwidth(static_cast<size_t>(level.hostBytesPerSec), 1.0, opts.unit) << " " << label << ":";
+    column("H2D", level.pass.h2d, levels.front().pass.h2d);
+    column("D2H", level.pass.d2h, levels.front().pass.d2h);
+    std::cout << "\n";
+  }
+}
+
+// Flags sustained throughput drops against the level of the first minute
+// (or first quarter of shorter runs), fed one value per second.
+struct ThrottleDetector {
+  struct Episode {
+    double start = 0, end = 0;
+    double worst = 0;  // lowest throughput seen, same unit as the input
+  };
+
+  double baselineSeconds = 60;
+  double dropFraction = 0.10;
+  int sustainSeconds = 5;
+
+  double baselineSum = 0;
+  int baselineCount = 0;
+  double baseline = 0;
+  int below = 0;
+  double belowSince = 0;
+  double worst = 0;
+  bool active = false;
+  std::vector<Episode> episodes;
+
+  // Returns +1 when a throttling episode is confirmed, -1 when it ends.
+  int add(double t, double value) {
+    if (t < baselineSeconds || baselineCount == 0) {
+      baselineSum += value;
+      ++baselineCount;
+      baseline = baselineSum / baselineCount;
+      return 0;
+    }
+    if (value < (1 - dropFraction) * baseline) {
+      if (below++ == 0) {
+        belowSince = t;
+        worst = value;
+      }
+      worst = std::min(worst, value);
+      if (!active && below >= sustainSeconds) {
+        active = true;
+        return 1;
+      }
+      return 0;
+    }
+    below = 0;
+    if (active) {
+      active = false;
+      episodes.push_back({ belowSince, t, worst });
+      return -1;
+    }
+    return 0;
+  }
+
+  void finish(double t) {
+    if (active) episodes.push_back({ belowSince, t, worst });
+    active = false;
+  }
+};
+
+struct SoakWindow {
+  std::vector<double> seconds;
+  double busy = 0;
+  double totalBusy = 0;
+  uint64_t totalTransfers = 0;
+  double minThroughput = 0, maxThroughput = 0;
+  ThrottleDetector throttle;
+  ChangePointDetector shifts;
+  std::vector<ChangePointDetector::ChangePoint> changePoints;
+};
+
+int run_soak(cl_command_queue queue, cl_mem deviceBuffer, void* hostPtr, void* recvPtr, size_t dataSize,
+             const Options& opts, Instruments& inst) {
+  WaitMode mode = opts.waitModes.front();
+  bool doH2D = opts.direction == Direction::HostToDevice || opts.direction == Direction::Both;
+  bool doD2H = opts.direction == Direction::DeviceToHost || opts.direction == Direction::Both;
+  const char* label = unit_label(opts.unit);
+
+  std::cout << "Soak: " << opts.duration << " s, wait mode " << wait_mode_name(mode)
+            << ", timeout " << inst.watchdog.timeout << " s" << std::endl;
+
+  SoakWindow h2d, d2h;
+  for (SoakWindow* w : { &h2d, &d2h }) {
+    w->throttle.baselineSeconds = std::min(60.0, opts.duration / 4);
+    w->shifts.learn = 200;  // soak runs are long; ignore shorter bursts
+  }
+
+  auto report = [&](const char* name, SoakWindow& w, double t) {
+    if (w.seconds.empty()) return;
+    std::sort(w.seconds.begin(), w.seconds.end());
+    double throughput = to_bandwidth(dataSize * w.seconds.size(), w.busy, opts.unit);
+    std::cout << "  " << name << " " << throughput << " " << label
+              << " (p50 " << percentile(w.seconds, 0.5) * 1e6 << " us, p99 " << percentile(w.seconds, 0.99) * 1e6
+              << " us, n=" << w.seconds.size() << ")";
+    if (w.totalTransfers == 0 || throughput < w.minThroughput) w.minThroughput = throughput;
+    if (throughput > w.maxThroughput) w.maxThroughput = throughput;
+    w.totalBusy += w.busy;
+    w.totalTransfers += w.seconds.size();
+    w.seconds.clear();
+    w.busy = 0;
+
+    int change = w.throttle.add(t, throughput);
+    if (change > 0) {
+      std::cout << " THROTTLING since t=" << w.throttle.belowSince << " s ("
+                << (1 - throughput / w.throttle.baseline) * 100 << "% below baseline "
+                << w.throttle.baseline << " " << label << ")";
+    } else if (change < 0) {
+      std::cout << " recovered";
+    }
+  };
+
+  double start = elapsed_seconds();
+  double nextReport = start + 1;
+  int64_t reportedErrors = 0;
+  if (inst.sensors.running()) inst.sensors.note_cpu();
+  auto runOne = [&](void* ptr, bool write, SoakWindow& w) {
+    Sample sample;
+    inst.watchdog.arm(write, dataSize);
+    int failed = measure(queue, deviceBuffer, ptr, dataSize, write, mode, sample);
+    inst.watchdog.disarm();
+    if (failed) return failed;
+    inst.samples.add(sample, dataSize, write, mode);
+    if (inst.sensors.running()) inst.sensors.note_cpu();
+    inst.link.poll();
+    ChangePointDetector::ChangePoint cp;
+    if (opts.changePoints && w.shifts.add(sample.timestamp - start, to_bandwidth(dataSize, sample.seconds, opts.unit), cp)) {
+      std::cout << "  Change point: " << (write ? "H2D" : "D2H") << " at t=" << cp.timestamp << " s: "
+                << cp.before << " -> " << cp.after << " " << label << " ("
+                << (cp.after / cp.before - 1) * 100 << "%)" << std::endl;
+      w.changePoints.push_back(cp);
+    }
+    w.seconds.push_back(sample.seconds);
+    w.busy += sample.seconds;
+    return 0;
+  };
+
+  for (;;) {
+    if (doH2D && runOne(hostPtr, true, h2d)) return 1;
+    if (doD2H && runOne(recvPtr, false, d2h)) return 1;
+
+    double now = elapsed_seconds();
+    if (now >= nextReport) {
+      double t = nextReport - start;
+      std::cout << "  t=" << std::setw(6) << std::lround(t) << " s";
+      if (doH2D) report("H2D", h2d, t);
+      if (doD2H) report("D2H", d2h, t);
+      if (inst.link.correctable_delta() > reportedErrors) {
+        std::cout << "  AER correctable +" << inst.link.correctable_delta() - reportedErrors;
+        reportedErrors = inst.link.correctable_delta();
+      }
+      std::cout << std::endl;
+      if (inst.sensors.running()) {
+        std::vector<SensorSample> window;
+        inst.sensors.drain(window);
+        if (!window.empty()) print_sensor_snapshot(inst.sensors, window, now);
+      }
+      while (nextReport <= now) nextReport += 1;
+    }
+    if (now - start >= opts.duration) break;
+  }
+
+  double end = elapsed_seconds() - start;
+  std::cout << "Soak summary (" << end << " s):\n";
+  auto summary = [&](const char* title, SoakWindow& w) {
+    w.throttle.finish(end);
+    std::cout << title << ":\n";
+    if (w.totalTransfers == 0) {
+      std::cout << "  No complete one-second window\n";
+      return;
+    }
+    std::cout << "  Avg: " << to_bandwidth(dataSize * w.totalTransfers, w.totalBusy, opts.unit) << " " << label
+              << " over " << w.totalTransfers << " transfers\n";
+    std::cout << "  Per-second min/max: " << w.minThroughput << " / " << w.maxThroughput << " " << label << "\n";
+    std::cout << "  Baseline (first " << w.throttle.baselineSeconds << " s): " << w.throttle.baseline << " "
+              << label << "\n";
+    if (w.throttle.episodes.empty()) {
+      std::cout << "  Throttling: none detected\n";
+    }
+    for (const auto& e : w.throttle.episodes) {
+      std::cout << "  Throttling: t=" << e.start << "-" << e.end << " s, down to " << e.worst << " " << label
+                << " (" << (1 - e.worst / w.throttle.baseline) * 100 << "% below baseline)\n";
+    }
+    if (opts.changePoints) {
+      std::cout << "  Change points: " << w.changePoints.size() << "\n";
+      for (const auto& cp : w.changePoints) {
+        std::cout << "    t=" << cp.timestamp << " s: " << cp.before << " -> " << cp.after << " " << label
+                  << " (" << (cp.after / cp.before - 1) * 100 << "%)\n";
+      }
+    }
+  };
+  if (doH2D) summary("Host to Device", h2d);
+  if (doD2H) summary("Device to Host", d2h);
+  if (inst.sensors.dropped.load() > 0) {
+    std::cout << "Sensors: " << inst.sensors.dropped.load() << " samples dropped (ring full)\n";
+  }
+  return 0;
+}
+
+std::string get_platform_string(cl_platform_id platform, cl_platform_info param) {
+  size_t size = 0;
+  if (clGetPlatformInfo(platform, param, 0, nullptr, &size) != CL_SUCCESS) return "";
+  std::string value(size, '\0');
+  clGetPlatformInfo(platform, param, size, &value[0], nullptr);
+  value.resize(strlen(value.c_str()));
+  return value;
+}
+
+std::string get_device_string(cl_device_id device, cl_device_info param) {
+  size_t size = 0;
+  if (clGetDeviceInfo(device, param, 0, nullptr, &size) != CL_SUCCESS) return "";
+  std::string value(size, '\0');
+  clGetDeviceInfo(device, param, size, &value[0], nullptr);
+  value.resize(strlen(value.c_str()));
+  return value;
+}
+
+// Host settings that make results from different machines comparable, plus
+// warnings for those known to distort them.
+struct Environment {
+  std::vector<std::pair<std::string, std::string>> items;
+  std::vector<std::string> warnings;
+};
+
+#ifndef _WIN32
+// Fraction of CPU time spent outside idle/iowait across all CPUs over the
+// given interval, from the aggregate line of /proc/stat. -1 if unreadable.
+double sample_cpu_busy(int ms) {
+  auto read = [](uint64_t& idle, uint64_t& total) {
+    std::ifstream f("/proc/stat");
+    std::string cpu;
+    f >> cpu;
+    if (cpu != "cpu") return false;
+    idle = total = 0;
+    uint64_t v;
+    for (int i = 0; i < 8 && f >> v; ++i) {
+      total += v;
+      if (i == 3 || i == 4) idle += v;
+    }
+    return total > 0;
+  };
+  uint64_t idle0, total0, idle1, total1;
+  if (!read(idle0, total0)) return -1;
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  if (!read(idle1, total1) || total1 <= total0) return -1;
+  return 1.0 - static_cast<double>(idle1 - idle0) / (total1 - total0);
+}
+
+// The bracketed choice of a sysfs selector such as "always [madvise] never".
+std::string sysfs_selected(const std::string& value) {
+  size_t open = value.find('['), close = value.find(']');
+  return (open != std::string::npos && close > open) ? value.substr(open + 1, close - open - 1) : value;
+}
+#endif
+
+Environment collect_environment(cl_platform_id platform, cl_device_id device, const std::string& sysfsRoot,
+                                const std::string& pciAddress) {
+  Environment env;
+  env.items.push_back({ "OpenCL", get_platform_string(platform, CL_PLATFORM_NAME) + " (" +
+                                  get_platform_string(platform, CL_PLATFORM_VERSION) + "), driver " +
+                                  get_device_string(device, CL_DRIVER_VERSION) + ", device " +
+                                  get_device_string(device, CL_DEVICE_VERSION) });
+#ifndef _WIN32
+  struct utsname uts;
+  if (uname(&uts) == 0) env.items.push_back({ "Kernel", std::string(uts.sysname) + " " + uts.release });
+
+  std::map<std::string, int> governors;
+  std::string cpuDir = sysfsRoot + "/devices/system/cpu";
+  for (const std::string& name : list_dir(cpuDir)) {
+    if (name.size() < 4 || name.compare(0, 3, "cpu") != 0 || !isdigit(static_cast<unsigned char>(name[3]))) continue;
+    std::string governor = read_first_line(cpuDir + "/" + name + "/cpufreq/scaling_governor");
+    if (!governor.empty()) ++governors[governor];
+  }
+  std::string governorList;
+  for (const auto& g : governors) {
+    governorList += (governorList.empty() ? "" : ", ") + g.first + " (" + std::to_string(g.second) + " CPUs)";
+    if (g.first == "powersave" || g.first == "conservative") {
+      env.warnings.push_back("CPU frequency governor '" + g.first +
+                             "' lowers clocks between transfers; use 'performance'");
+    }
+  }
+  env.items.push_back({ "Governor", governorList.empty() ? "unknown" : governorList });
+
+  std::string clocksource =
+    read_first_line(sysfsRoot + "/devices/system/clocksource/clocksource0/current_clocksource");
+  env.items.push_back({ "Clocksource", clocksource.empty() ? "unknown" : clocksource });
+
+  std::string smt = read_first_line(cpuDir + "/smt/control");
+  env.items.push_back({ "SMT", smt.empty() ? "unknown" : smt });
+
+  std::string iommu = pciAddress.empty() ? "" :
+    read_first_line(sysfsRoot + "/bus/pci/devices/" + pciAddress + "/iommu_group/type");
+  if (iommu.empty()) iommu = list_dir(sysfsRoot + "/class/iommu").empty() ? "off" : "on";
+  else if (iommu.compare(0, 3, "DMA") == 0) iommu += " (translated)";
+  else if (iommu == "identity") iommu += " (passthrough)";
+  env.items.push_back({ "IOMMU", iommu });
+
+  std::string thp = sysfs_selected(read_first_line(sysfsRoot + "/kernel/mm/transparent_hugepage/enabled"));
+  env.items.push_back({ "THP", thp.empty() ? "unknown" : thp });
+
+  struct rlimit memlock;
+  if (getrlimit(RLIMIT_MEMLOCK, &memlock) == 0) {
+    env.items.push_back({ "Memlock limit", memlock.rlim_cur == RLIM_INFINITY ? "unlimited"
+                                                                              : format_size(memlock.rlim_cur) });
+  }
+
+  double busy = sample_cpu_busy(250);
+  std::string load = read_first_line("/proc/loadavg");
+  std::istringstream ls(load);
+  std::string l1, l5, l15;
+  ls >> l1 >> l5 >> l15;
+  std::ostringstream background;
+  background << std::fixed << std::setprecision(1);
+  if (busy >= 0) background << busy * 100 << "% CPU busy, ";
+  background << "loadavg " << l1 << " " << l5 << " " << l15;
+  env.items.push_back({ "Background load", background.str() });
+  if (busy > 0.1) env.warnings.push_back("host is busy (" + background.str() + ")");
+#else
+  (void)sysfsRoot;
+  (void)pciAddress;
+#endif
+  return env;
+}
+
+void print_clock_calibration(const std::vector<ClockCalibration>& cals) {
+  std::cout << "Timer calibration:\n";
+  for (const ClockCalibration& cal : cals) {
+    std::cout << "  " << clock_source_name(cal.source) << ": ";
+    if (!cal.available) {
+      std::cout << "not available\n";
+      continue;
+    }
+    std::cout << cal.readNs << " ns/read, resolution " << cal.resolutionNs << " ns";
+    if (!cal.note.empty()) std::cout << " (" << cal.note << ")";
+    if (!cal.reliable()) std::cout << ", not used";
+    std::cout << "\n";
+  }
+  std::cout << "  Selected: " << clock_source_name(transferClock.source) << "\n";
+}
+
+void print_environment(const Environment& env) {
+  std::cout << "Environment:\n";
+  for (const auto& item : env.items) std::cout << "  " << item.first << ": " << item.second << "\n";
+  for (const std::string& w : env.warnings) std::cout << "  Warning: " << w << "\n";
+}
+
+// Sweeps host pointer alignment, device buffer offset and sizes one byte past
+// a power of two to find slow paths where the runtime falls back to bounce
+// buffers. Host memory is registered with CL_MEM_USE_HOST_PTR at the tested
+// alignment and its mapping is transferred through measure(); each cell is
+// the average bandwidth over --rounds transfers.
+int run_alignment_sweep(cl_context context, cl_command_queue queue, const std::vector<size_t>& baseSizes,
+                        const Options& opts) {
+  struct Column {
+    const char* label;
+    size_t hostOffset, deviceOffset;
+  };
+  const Column columns[] = {
+    { "host 4K", 0, 0 }, { "host 256", 256, 0 }, { "host 64", 64, 0 }, { "host 1", 1, 0 },
+    { "dev +64", 0, 64 }, { "dev +1", 0, 1 },
+  };
+  const size_t page = 4096;
+
+  std::vector<size_t> sizes;
+  for (size_t s : baseSizes) {
+    sizes.push_back(s);
+    sizes.push_back(s + 1);
+  }
+
+  auto sizeLabel = [](size_t s) {
+    return (s % 1024 == 0) ? format_size(s) : std::to_string(s) + " B";
+  };
+
+  const char* label = unit_label(opts.unit);
+  bool doH2D = opts.direction != Direction::DeviceToHost;
+  bool doD2H = opts.direction != Direction::HostToDevice;
+  for (bool write : { true, false }) {
+    if ((write && !doH2D) || (!write && !doD2H)) continue;
+    std::cout << "\nAlignment sweep, " << (write ? "Host to Device" : "Device to Host") << " (" << label
+              << ", * = below 75% of the aligned case):\n";
+    std::cout << "  " << std::left << std::setw(12) << "size" << std::right;
+    for (const Column& c : columns) std::cout << std::setw(12) << c.label;
+    std::cout << "\n";
+
+    for (size_t size : sizes) {
+      std::vector<unsigned char> storage(size + 2 * page);
+      unsigned char* base = storage.data() + (page - reinterpret_cast<uintptr_t>(storage.data()) % page);
+      fill_pattern(base, size + page, opts.pattern);
+      cl_int status;
+      cl_mem deviceBuf = clCreateBuffer(context, CL_MEM_READ_WRITE, size + page, nullptr, &status);
+      CHECK(status, "Failed to allocate device buffer");
+
+      std::cout << "  " << std::left << std::setw(12) << sizeLabel(size) << std::right;
+      double aligned = 0;
+      for (const Column& c : columns) {
+        cl_mem hostBuf = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size,
+                                        base + c.hostOffset, &status);
+        CHECK(status, "Failed to register host memory");
+        // Transfers use the mapped pointer, which the runtime recognizes as
+        // belonging to the registered buffer.
+        void* ptr = clEnqueueMapBuffer(queue, hostBuf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size, 0, nullptr,
+                                       nullptr, &status);
+        if (status != CL_SUCCESS) clReleaseMemObject(hostBuf);
+        CHECK(status, "Failed to map registered host memory");
+
+        double seconds = 0;
+        for (int i = -1; i < opts.rounds; ++i) {  // i = -1 warms up
+          Sample sample;
+          if (measure(queue, deviceBuf, ptr, size, write, opts.waitModes.front(), sample, c.deviceOffset)) {
+            clEnqueueUnmapMemObject(queue, hostBuf, ptr, 0, nullptr, nullptr);
+            clReleaseMemObject(hostBuf);
+            clReleaseMemObject(deviceBuf);
+            return 1;
+          }
+          if (i >= 0) seconds += sample.seconds;
+        }
+        clEnqueueUnmapMemObject(queue, hostBuf, ptr, 0, nullptr, nullptr);
+        clFinish(queue);
+        clReleaseMemObject(hostBuf);
+
+        double bandwidth = to_bandwidth(size * opts.rounds, seconds, opts.unit);
+        if (c.hostOffset == 0 && c.deviceOffset == 0) aligned = bandwidth;
+        std::cout << std::setw(11) << bandwidth << (bandwidth < 0.75 * aligned ? "*" : " ");
+      }
+      std::cout << "\n";
+      clReleaseMemObject(deviceBuf);
+    }
+  }
+  return 0;
+}
+
+// CPU streaming kernels for mapped buffers. The non-temporal variants use
+// MOVNTDQ stores and MOVNTDQA loads, the only fast way to read
+// write-combined memory such as a BAR mapping of VRAM. Sizes are multiples
+// of 16 bytes and pointers are 16-byte aligned. The SIMD kernels are built
+// for SSE2/SSE4.1 regardless of -march (i686 builds don't assume SSE2) and
+// chosen at run time; plain loops cover CPUs without them.
+void cpu_store_plain(void* p, size_t n) {
+  memset(p, 0x5A, n);
+}
+
+uint64_t cpu_load_plain(const void* p, size_t n) {
+  uint64_t acc = 0;
+  for (const uint64_t* q = static_cast<const uint64_t*>(p), *end = q + n / 8; q < end; ++q) acc ^= *q;
+  return acc;
+}
+
+#ifdef HAVE_TSC
+__attribute__((target("sse2")))
+void cpu_store_sse2(void* p, size_t n) {
+  __m128i v = _mm_set1_epi8(0x5A);
+  for (__m128i* q = static_cast<__m128i*>(p), *end = q + n / 16; q < end; ++q) _mm_store_si128(q, v);
+}
+
+__attribute__((target("sse2")))
+void cpu_store_nt_sse2(void* p, size_t n) {
+  __m128i v = _mm_set1_epi8(0x5A);
+  for (__m128i* q = static_cast<__m128i*>(p), *end = q + n / 16; q < end; ++q) _mm_stream_si128(q, v);
+  _mm_sfence();
+}
+
+__attribute__((target("sse2")))
+uint64_t cpu_load_sse2(const void* p, size_t n) {
+  __m128i acc = _mm_setzero_si128();
+  for (const __m128i* q = static_cast<const __m128i*>(p), *end = q + n / 16; q < end; ++q) {
+    acc = _mm_xor_si128(acc, _mm_load_si128(q));
+  }
+  return static_cast<uint64_t>(_mm_cvtsi128_si32(acc));
+}
+
+__attribute__((target("sse4.1")))
+uint64_t cpu_load_nt_sse41(const void* p, size_t n) {
+  __m128i acc = _mm_setzero_si128();
+  for (__m128i* q = static_cast<__m128i*>(const_cast<void*>(p)), *end = q + n / 16; q < end; ++q) {
+    acc = _mm_xor_si128(acc, _mm_stream_load_si128(q));
+  }
+  return static_cast<uint64_t>(_mm_cvtsi128_si32(acc));
+}
+
+bool has_simd_access() {
+  return __builtin_cpu_supports("sse2");
+}
+
+bool has_nt_load() {
+  return __builtin_cpu_supports("sse4.1");
+}
+
+void cpu_store(void* p, size_t n) {
+  if (has_simd_access()) cpu_store_sse2(p, n);
+  else cpu_store_plain(p, n);
+}
+
+void cpu_store_nt(void* p, size_t n) {
+  if (has_simd_access()) cpu_store_nt_sse2(p, n);
+  else cpu_store_plain(p, n);
+}
+
+uint64_t cpu_load(const void* p, size_t n) {
+  return has_simd_access() ? cpu_load_sse2(p, n) : cpu_load_plain(p, n);
+}
+
+uint64_t cpu_load_nt(const void* p, size_t n) {
+  return has_nt_load() ? cpu_load_nt_sse41(p, n) : cpu_load_plain(p, n);
+}
+#else
+bool has_simd_access() {
+  return false;
+}
+
+bool has_nt_load() {
+  return false;
+}
+
+void cpu_store(void* p, size_t n) {
+  cpu_store_plain(p, n);
+}
+
+void cpu_store_nt(void* p, size_t n) {
+  cpu_store_plain(p, n);
+}
+
+uint64_t cpu_load(const void* p, size_t n) {
+  return cpu_load_plain(p, n);
+}
+
+uint64_t cpu_load_nt(const void* p, size_t n) {
+  return cpu_load_plain(p, n);
+}
+#endif
+
+// CPU store and load bandwidth into a mapped device-side buffer, with and
+// without CL_MEM_ALLOC_HOST_PTR. Whether the mapping is the VRAM BAR itself,
+// a write-combined aperture or a staging copy is up to the runtime; slow map
+// and unmap times point to a copy.
+int run_cpu_access(cl_context context, cl_command_queue queue, size_t dataSize, const Options& opts) {
+  size_t size = dataSize & ~static_cast<size_t>(15);
+  const char* label = unit_label(opts.unit);
+  std::cout << "\nCPU access to mapped buffers (" << format_size(size) << ", " << label << "):\n";
+
+  struct Variant {
+    const char* title;
+    cl_mem_flags flags;
+  };
+  const Variant variants[] = {
+    { "Device buffer", CL_MEM_READ_WRITE },
+    { "ALLOC_HOST_PTR buffer", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR },
+  };
+
+  for (const Variant& v : variants) {
+    cl_int status;
+    cl_mem buffer = clCreateBuffer(context, v.flags, size, nullptr, &status);
+    CHECK(status, "Failed to allocate buffer");
+
+    auto mapStart = std::chrono::steady_clock::now();
+    void* ptr = clEnqueueMapBuffer(queue, buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size, 0, nullptr,
+                                   nullptr, &status);
+    CHECK(status, "Failed to map buffer");
+    double mapSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mapStart).count();
+
+    // Best of up to three runs, fewer once a second has been spent (reads of
+    // uncached memory can be very slow).
+    volatile uint64_t sink = 0;
+    auto best = [&](auto op) {
+      double fastest = std::numeric_limits<double>::max(), total = 0;
+      for (int run = 0; run < 3 && total < 1.0; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        op();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fastest = std::min(fastest, seconds);
+        total += seconds;
+      }
+      return to_bandwidth(size, fastest, opts.unit);
+    };
+    double store = best([&] { cpu_store(ptr, size); });
+    double storeNt = has_simd_access() ? best([&] { cpu_store_nt(ptr, size); }) : 0;
+    double load = best([&] { sink = sink + cpu_load(ptr, size); });
+    double loadNt = has_nt_load() ? best([&] { sink = sink + cpu_load_nt(ptr, size); }) : 0;
+
+    cl_event unmapEvent = nullptr;
+    auto unmapStart = std::chrono::steady_clock::now();
+    status = clEnqueueUnmapMemObject(queue, buffer, ptr, 0, nullptr, &unmapEvent);
+    CHECK(status, "Failed to unmap buffer");
+    clWaitForEvents(1, &unmapEvent);
+    double unmapSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - unmapStart).count();
+    clReleaseEvent(unmapEvent);
+    clReleaseMemObject(buffer);
+
+    std::cout << "  " << v.title << ": map " << mapSeconds * 1e3 << " ms, unmap " << unmapSeconds * 1e3 << " ms\n"
+              << "    store " << store;
+    if (has_simd_access()) std::cout << ", non-temporal store " << storeNt;
+    std::cout << ", load " << load;
+    if (has_nt_load()) std::cout << ", non-temporal load " << loadNt;
+    std::cout << " " << label << "\n";
+  }
+  return 0;
+}
+
+// Host memory limits relevant to the buffers this tool allocates. Zero means
+// unknown or unlimited.
+struct HostMemory {
+  uint64_t available = 0;    // MemAvailable
+  uint64_t cgroupLimit = 0;  // memory.max / memory.limit_in_bytes
+  uint64_t cgroupUsage = 0;
+  uint64_t memlock = 0;      // RLIMIT_MEMLOCK
+};
+
+#ifdef _WIN32
+HostMemory read_host_memory(const std::string&) {
+  HostMemory mem;
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status)) mem.available = status.ullAvailPhys;
+  return mem;
+}
+#else
+// Value in bytes of a "Key:   1234 kB" line in /proc/meminfo or
+// /proc/self/status, 0 if missing.
+uint64_t read_kb_field(const std::string& path, const std::string& key) {
+  std::ifstream f(path);
+  std::string line;
+  while (std::getline(f, line)) {
+    if (line.compare(0, key.size() + 1, key + ":") == 0) return std::stoull(line.substr(key.size() + 1)) * 1024;
+  }
+  return 0;
+}
+
+HostMemory read_host_memory(const std::string& sysfsRoot) {
+  HostMemory mem;
+  mem.available = read_kb_field("/proc/meminfo", "MemAvailable");
+
+  std::ifstream cgroups("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(cgroups, line)) {
+    size_t first = line.find(':'), second = line.find(':', first + 1);
+    if (first == std::string::npos || second == std::string::npos) continue;
+    std::string controllers = line.substr(first + 1, second - first - 1), path = line.substr(second + 1);
+    std::string base, limitFile, usageFile;
+    if (controllers.empty()) {  // cgroup v2
+      base = sysfsRoot + "/fs/cgroup";
+      limitFile = "/memory.max";
+      usageFile = "/memory.current";
+    } else if (controllers.find("memory") != std::string::npos) {
+      base = sysfsRoot + "/fs/cgroup/memory";
+      limitFile = "/memory.limit_in_bytes";
+      usageFile = "/memory.usage_in_bytes";
+    } else {
+      continue;
+    }
+    // Every ancestor's limit applies too; keep the level with the least headroom.
+    for (;;) {
+      std::string dir = base + (path == "/" ? "" : path);
+      std::string limit = read_first_line(dir + limitFile), usage = read_first_line(dir + usageFile);
+      uint64_t value = (limit.empty() || limit == "max") ? 0 : std::stoull(limit);
+      if (value > 0 && value < (1ULL << 60)) {
+        uint64_t used = usage.empty() ? 0 : std::stoull(usage);
+        uint64_t headroom = value > used ? value - used : 0;
+        uint64_t best = mem.cgroupLimit > mem.cgroupUsage ? mem.cgroupLimit - mem.cgroupUsage : 0;
+        if (mem.cgroupLimit == 0 || headroom < best) {
+          mem.cgroupLimit = value;
+          mem.cgroupUsage = used;
+        }
+      }
+      size_t slash = path.find_last_of('/');
+      if (path.empty() || path == "/" || slash == std::string::npos) break;
+      path = slash == 0 ? "/" : path.substr(0, slash);
+    }
+  }
+
+  struct rlimit memlock;
+  if (getrlimit(RLIMIT_MEMLOCK, &memlock) == 0 && memlock.rlim_cur != RLIM_INFINITY) mem.memlock = memlock.rlim_cur;
+  return mem;
+}
+#endif
+
+// Host memory the size loop may use and how each size fits into it: both
+// pinned buffers, one pinned buffer shared for sending and receiving, or not
+// at all. Background interference buffers count as pageable memory.
+struct MemoryPlan {
+  uint64_t budget = 0;
+  uint64_t pageable = 0;
+  uint64_t peakPinned = 0;
+  std::vector<size_t> shared;   // sizes run with a single host buffer
+  std::vector<size_t> skipped;
+
+  bool is_shared(size_t size) const {
+    return std::find(shared.begin(), shared.end(), size) != shared.end();
+  }
+};
+
+// Fits sizes into the budget (--memory-budget, or 75% of what the host and
+// the cgroup leave available), removing those that don't fit at all.
+MemoryPlan plan_memory(std::vector<size_t>& sizes, const Options& opts, const HostMemory& mem) {
+  MemoryPlan plan;
+  uint64_t available = mem.available;
+  if (mem.cgroupLimit > 0) {
+    uint64_t cgroupFree = mem.cgroupLimit > mem.cgroupUsage ? mem.cgroupLimit - mem.cgroupUsage : 0;
+    available = available ? std::min(available, cgroupFree) : cgroupFree;
+  }
+  plan.budget = opts.memoryBudget ? opts.memoryBudget : available / 4 * 3;
+
+  int threads = opts.interference.empty() ? 0 : *std::max_element(opts.interference.begin(),
+                                                                    opts.interference.end());
+  plan.pageable = static_cast<uint64_t>(threads) * MemoryInterference::bufferSize *
+                  (opts.interferenceOp == StreamOp::Copy ? 2 : 1);
+  if (plan.budget == 0) return plan;  // nothing known, no limit
+
+  std::vector<size_t> fitting;
+  for (size_t size : sizes) {
+    uint64_t pinned = 2 * static_cast<uint64_t>(size);
+    if (pinned + plan.pageable > plan.budget) {
+      pinned = size;
+      if (pinned + plan.pageable > plan.budget) {
+        plan.skipped.push_back(size);
+        continue;
+      }
+      plan.shared.push_back(size);
+    }
+    plan.peakPinned = std::max(plan.peakPinned, pinned);
+    fitting.push_back(size);
+  }
+  sizes = fitting;
+  return plan;
+}
+
+void print_memory_plan(const MemoryPlan& plan, const HostMemory& mem, const Options& opts) {
+  std::cout << "Memory budget: ";
+  if (plan.budget == 0) {
+    std::cout << "unknown, not enforced\n";
+    return;
+  }
+  std::cout << format_size(plan.budget) << (opts.memoryBudget ? " (--memory-budget)" : " (75% of free)")
+            << ", available " << format_size(mem.available);
+  if (mem.cgroupLimit) {
+    std::cout << ", cgroup " << format_size(mem.cgroupUsage) << " of " << format_size(mem.cgroupLimit) << " used";
+  }
+  std::cout << ", memlock " << (mem.memlock ? format_size(mem.memlock) : std::string("unlimited")) << "\n";
+  std::cout << "  Planned peak: " << format_size(plan.peakPinned) << " pinned, " << format_size(plan.pageable)
+            << " pageable\n";
+  for (size_t size : plan.shared) {
+    std::cout << "  " << format_size(size) << ": send and receive share one pinned buffer\n";
+  }
+  for (size_t size : plan.skipped) {
+    std::cout << "  " << format_size(size) << ": skipped, does not fit\n";
+  }
+  if (mem.memlock && plan.peakPinned > mem.memlock) {
+    std::cout << "  Warning: planned pinned memory exceeds RLIMIT_MEMLOCK; the runtime may fall back to "
+                 "pageable copies\n";
+  }
+}
+
+// Process memory high-water marks, sampled after each size's buffers exist.
+struct MemoryUsage {
+  uint64_t peakRss = 0;
+  uint64_t peakPinned = 0;  // what the kernel counts as locked or pinned
+  uint64_t peakPlanned = 0; // pinned buffers this tool allocated
+
+  void sample(uint64_t plannedPinned) {
+    peakPlanned = std::max(peakPlanned, plannedPinned);
+#ifndef _WIN32
+    peakRss = std::max(peakRss, read_kb_field("/proc/self/status", "VmHWM"));
+    peakPinned = std::max(peakPinned, read_kb_field("/proc/self/status", "VmLck") +
+                                      read_kb_field("/proc/self/status", "VmPin"));
+#endif
+  }
+};
+
+void print_memory_usage(const MemoryUsage& usage) {
+  std::cout << "\nMemory: " << format_size(usage.peakPlanned) << " peak pinned buffers";
+#ifndef _WIN32
+  std::cout << ", peak RSS " << format_size(usage.peakRss) << ", peak locked/pinned per kernel "
+            << format_size(usage.peakPinned);
+#endif
+  std::cout << "\n";
+}
+
+// One GPU taking part in the multi-device contention run.
+struct ContentionDevice {
+  int index = 0;
+  cl_context context = nullptr;
+  cl_command_queue queue = nullptr;
+  cl_mem hostBuf = nullptr, deviceBuf = nullptr;
+  void* hostPtr = nullptr;
+  double alone = 0, concurrent = 0;  // bandwidth in the output unit
+};
+
+int run_series(ContentionDevice& dev, size_t dataSize, bool write, const Options& opts, double& seconds) {
+  Sample sample;
+  if (measure(dev.queue, dev.deviceBuf, dev.hostPtr, dataSize, write, opts.waitModes.front(), sample)) return 1;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < opts.rounds; ++i) {
+    if (measure(dev.queue, dev.deviceBuf, dev.hostPtr, dataSize, write, opts.waitModes.front(), sample)) return 1;
+  }
+  seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return 0;
+}
+
+// Measures every selected GPU alone and then all of them at once, and compares
+// the slowdown behind each shared uplink with the prediction from its link
+// budget: GPUs behind a link cannot together exceed its payload bandwidth.
+int run_contention(const std::vector<cl_device_id>& devices, const std::vector<int>& selected,
+                   const PciTopology& topo, size_t dataSize, const Options& opts) {
+  std::vector<ContentionDevice> devs(selected.size());
+  cl_int status;
+  for (size_t i = 0; i < selected.size(); ++i) {
+    ContentionDevice& dev = devs[i];
+    dev.index = selected[i];
+    cl_device_id device = devices[dev.index];
+    dev.context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &status);
+    CHECK(status, "Failed to create context");
+    dev.queue = clCreateCommandQueue(dev.context, device, CL_QUEUE_PROFILING_ENABLE, &status);
+    CHECK(status, "Failed to create command queue");
+    dev.hostBuf = clCreateBuffer(dev.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, dataSize, nullptr, &status);
+    CHECK(status, "Failed to allocate pinned host buffer");
+    dev.hostPtr = clEnqueueMapBuffer(dev.queue, dev.hostBuf, CL_TRUE, CL_MAP_WRITE, 0, dataSize, 0, nullptr,
+                                     nullptr, &status);
+    CHECK(status, "Failed to map host buffer");
+    fill_pattern(dev.hostPtr, dataSize, opts.pattern);
+    dev.deviceBuf = clCreateBuffer(dev.context, CL_MEM_READ_WRITE, dataSize, nullptr, &status);
+    CHECK(status, "Failed to allocate device buffer");
+    CHECK(clEnqueueWriteBuffer(dev.queue, dev.deviceBuf, CL_TRUE, 0, dataSize, dev.hostPtr, 0, nullptr, nullptr),
+          "Failed to initialize device buffer");
+  }
+
+  const char* label = unit_label(opts.unit);
+  bool doH2D = opts.direction != Direction::DeviceToHost;
+  bool doD2H = opts.direction != Direction::HostToDevice;
+  for (bool write : { true, false }) {
+    if ((write && !doH2D) || (!write && !doD2H)) continue;
+    std::cout << "\n[Contention: " << format_size(dataSize) << ", " << (write ? "Host to Device" : "Device to Host")
+              << ", " << devs.size() << " devices]\n";
+
+    for (ContentionDevice& dev : devs) {
+      double seconds = 0;
+      if (run_series(dev, dataSize, write, opts, seconds)) return 1;
+      dev.alone = to_bandwidth(dataSize * opts.rounds, seconds, opts.unit);
+    }
+
+    std::atomic<int> ready{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    for (ContentionDevice& dev : devs) {
+      threads.emplace_back([&, write] {
+        ready.fetch_add(1);
+        while (ready.load() < static_cast<int>(devs.size())) std::this_thread::yield();
+        double seconds = 0;
+        if (run_series(dev, dataSize, write, opts, seconds)) failed = true;
+        else dev.concurrent = to_bandwidth(dataSize * opts.rounds, seconds, opts.unit);
+      });
+    }
+    for (auto& t : threads) t.join();
+    if (failed) return 1;
+
+    double aloneSum = 0, concurrentSum = 0;
+    for (const ContentionDevice& dev : devs) {
+      std::cout << "  GPU " << dev.index << ": alone " << dev.alone << " " << label << ", concurrent "
+                << dev.concurrent << " " << label << " (" << dev.concurrent / dev.alone * 100 << "%)\n";
+      aloneSum += dev.alone;
+      concurrentSum += dev.concurrent;
+    }
+
+    for (const auto& up : topo.uplinks) {
+      double alone = 0, concurrent = 0;
+      int members = 0;
+      for (const ContentionDevice& dev : devs) {
+        if (std::find(up.gpus.begin(), up.gpus.end(), dev.index) == up.gpus.end()) continue;
+        alone += dev.alone;
+        concurrent += dev.concurrent;
+        ++members;
+      }
+      if (members < 2) continue;
+      double predicted = alone;
+      if (up.link.valid) predicted = std::min(alone, to_bandwidth(1, 1 / up.link.payloadBytesPerSec, opts.unit));
+      std::cout << "  Uplink " << up.address << " (" << format_link(up.link) << "), GPUs "
+                << format_gpu_list(up.gpus) << ": predicted " << predicted << " " << label << ", measured "
+                << concurrent << " " << label << " (" << concurrent / predicted * 100 << "% of predicted)\n";
+    }
+    std::cout << "  All devices: " << concurrentSum << " " << label << " concurrent vs " << aloneSum << " "
+              << label << " sum alone (" << concurrentSum / aloneSum * 100 << "%)\n";
+  }
+
+  for (ContentionDevice& dev : devs) {
+    clEnqueueUnmapMemObject(dev.queue, dev.hostBuf, dev.hostPtr, 0, nullptr, nullptr);
+    clFinish(dev.queue);
+    clReleaseMemObject(dev.hostBuf);
+    clReleaseMemObject(dev.deviceBuf);
+    clReleaseCommandQueue(dev.queue);
+    clReleaseContext(dev.context);
+  }
+  return 0;
+}
+
+// Machine-readable summary of the size loop (--format json|csv). The schema
+// string changes its number whenever a field is added, renamed, removed or
+// changes meaning. Bandwidths are bytes/s and times seconds, independent of
+// --unit. Instruments that were not enabled report null (JSON) or an empty
+// field (CSV).
+const char* const reportSchema = "gpu-pcie-bench/2";
+
+struct ReportRow {
+  size_t size = 0;
+  Direction direction = Direction::HostToDevice;
+  WaitMode mode = WaitMode::Block;
+  int loadThreads = 0;
+  size_t samples = 0;
+  Summary s;
+  double linkEfficiency = -1;  // avg bandwidth / link payload bandwidth, -1 if unknown
+  size_t stalls = 0, changePoints = 0;
+  double cv = 0;                // of the per-transfer times
+  double baselineCv = -1;       // unstabilized pass, -1 without --stabilize
+  double floor = 0;             // subtracted noise floor, 0 without --subtract-floor
+  double hostBytesPerSec = -1;  // background load bandwidth, -1 without --interference
+  std::vector<std::pair<std::string, double>> perf;    // per transfer, plus IPC
+  std::vector<std::pair<std::string, double>> energy;  // J/GB per source
+  std::vector<SensorRange> sensors;
+  bool periodsChecked = false;  // --periodicity with enough samples
+  std::vector<Period> periods;
+};
+
+struct ReportSize {
+  size_t size = 0;
+  bool shared = false;
+  bool verified = false;
+  uint64_t verifyChecks = 0, verifyFailures = 0;
+  int64_t aerCorrectable = -1;
+  size_t linkChanges = 0;
+};
+
+struct Report {
+  std::string cpu, gpu, pci;
+  uint64_t gpuMemory = 0;
+  LinkBudget link;
+  Environment env;
+  std::map<WaitMode, NoiseFloor> floors;
+  std::vector<size_t> sizes;
+  std::vector<ReportSize> results;
+  std::vector<ReportRow> rows;
+  bool perfEnabled = false, sensorsEnabled = false;
+
+  // baseline is the unstabilized pass with --stabilize, null otherwise.
+  void add_pass(const PassResult& pass, const PassResult* baseline, size_t dataSize, int loadThreads,
+                const Options& opts, const Instruments& inst) {
+    for (Direction d : { Direction::HostToDevice, Direction::DeviceToHost }) {
+      if (opts.direction != Direction::Both && opts.direction != d) continue;
+      const DirectionStats& stats = d == Direction::HostToDevice ? pass.h2d : pass.d2h;
+      ReportRow row;
+      row.size = dataSize;
+      row.direction = d;
+      row.mode = pass.mode;
+      row.loadThreads = loadThreads;
+      row.samples = stats.samples.size();
+      row.s = summarize(stats, dataSize);
+      if (link.valid && row.s.avg > 0) row.linkEfficiency = dataSize / row.s.avg / link.payloadBytesPerSec;
+      row.stalls = stats.stalls.size();
+      row.changePoints = stats.changePoints.size();
+      row.cv = time_cv(stats);
+      if (baseline) row.baselineCv = time_cv(d == Direction::HostToDevice ? baseline->h2d : baseline->d2h);
+      if (opts.subtractFloor) row.floor = pass.floor.marker;
+
+      double n = static_cast<double>(row.samples);
+      perfEnabled = inst.perf.available();
+      sensorsEnabled = inst.sensors.running();
+      if (perfEnabled && n > 0) {
+        for (int i = 0; i < PerfCounterCount; ++i) {
+          if (inst.perf.has(i)) row.perf.emplace_back(perfCounterNames[i], stats.perf.value[i] / n);
+        }
+        if (inst.perf.has(PerfCycles) && inst.perf.has(PerfInstructions) && stats.perf.value[PerfCycles] > 0) {
+          row.perf.emplace_back("IPC", stats.perf.value[PerfInstructions] / stats.perf.value[PerfCycles]);
+        }
+      }
+      if (opts.energy && n > 0) {
+        double gigabytes = static_cast<double>(dataSize) * n / (1024.0 * 1024.0 * 1024.0);
+        for (const auto& j : energy_joules(inst, stats)) row.energy.emplace_back(j.first, j.second / gigabytes);
+      }
+      if (sensorsEnabled) row.sensors = sensor_ranges(inst.sensors, stats.sensors);
+      if (opts.periodicity && stats.samples.size() >= 32) {
+        row.periodsChecked = true;
+        row.periods = find_periods(stats.samples);
+      }
+      rows.push_back(row);
+    }
+  }
+
+  void set_host_load(size_t dataSize, int loadThreads, double bytesPerSec) {
+    for (ReportRow& row : rows) {
+      if (row.size == dataSize && row.loadThreads == loadThreads) row.hostBytesPerSec = bytesPerSec;
+    }
+  }
+};
+
+std::string report_timestamp() {
+  std::time_t now = std::time(nullptr);
+  char buf[32];
+  std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+  return buf;
+}
+
+std::string json_string(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+// Number or null; JSON has no NaN or infinity.
+std::string json_number(double v) {
+  if (!std::isfinite(v)) return "null";
+  std::ostringstream s;
+  s << std::setprecision(9) << v;
+  return s.str();
+}
+
+// Environment labels as object keys: "Memlock limit" -> "memlock_limit".
+std::string json_key(const std::string& label) {
+  std::string key;
+  for (char c : label) key += c == ' ' ? '_' : static_cast<char>(::tolower(static_cast<unsigned char>(c)));
+  return key;
+}
+
+void write_json(std::ostream& out, const Report& r, const Options& opts) {
+  auto list = [](const std::vector<std::string>& items) {
+    std::string s = "[";
+    for (size_t i = 0; i < items.size(); ++i) s += (i ? ", " : "") + items[i];
+    return s + "]";
+  };
+  // Named values as an object, null when the instrument was off.
+  auto values = [](const std::vector<std::pair<std::string, double>>& items, bool enabled) {
+    if (!enabled) return std::string("null");
+    std::string s = "{";
+    for (size_t i = 0; i < items.size(); ++i) {
+      s += (i ? ", " : " ") + json_string(json_key(items[i].first)) + ": " + json_number(items[i].second);
+    }
+    return s + (items.empty() ? "}" : " }");
+  };
+
+  out << "{\n";
+  out << "  \"schema\": " << json_string(reportSchema) << ",\n";
+  out << "  \"version\": " << json_string(VERSION) << ",\n";
+  out << "  \"timestamp\": " << json_string(report_timestamp()) << ",\n";
+
+  out << "  \"device\": {\n";
+  out << "    \"cpu\": " << json_string(r.cpu) << ",\n";
+  out << "    \"gpu\": " << json_string(r.gpu) << ",\n";
+  out << "    \"gpu_memory_bytes\": " << r.gpuMemory << ",\n";
+  out << "    \"pci\": " << (r.pci.empty() ? "null" : json_string(r.pci)) << ",\n";
+  out << "    \"link\": ";
+  if (r.link.valid) {
+    out << "{ \"generation\": " << LinkBudget::generation(r.link.maxSpeed)
+        << ", \"speed_gts\": " << json_number(r.link.speed) << ", \"width\": " << r.link.width
+        << ", \"max_speed_gts\": " << json_number(r.link.maxSpeed) << ", \"max_width\": " << r.link.maxWidth
+        << ", \"mps_bytes\": " << r.link.mps << ", \"mps_assumed\": " << (r.link.mpsAssumed ? "true" : "false")
+        << ", \"raw_bytes_per_s\": " << json_number(r.link.rawBytesPerSec)
+        << ", \"payload_bytes_per_s\": " << json_number(r.link.payloadBytesPerSec) << " }\n";
+  } else {
+    out << "null\n";
+  }
+  out << "  },\n";
+
+  std::vector<std::string> modes, sizes, levels;
+  for (WaitMode m : opts.waitModes) modes.push_back(json_string(wait_mode_name(m)));
+  for (size_t s : r.sizes) sizes.push_back(std::to_string(s));
+  for (int t : opts.interference) levels.push_back(std::to_string(t));
+  out << "  \"config\": {\n";
+  out << "    \"rounds\": " << opts.rounds << ",\n";
+  out << "    \"direction\": " << json_string(direction_name(opts.direction)) << ",\n";
+  out << "    \"sizes_bytes\": " << list(sizes) << ",\n";
+  out << "    \"wait_modes\": " << list(modes) << ",\n";
+  out << "    \"pattern\": " << json_string(pattern_name(opts.pattern)) << ",\n";
+  out << "    \"clock\": " << json_string(clock_source_name(transferClock.source)) << ",\n";
+  out << "    \"duration_s\": " << json_number(opts.duration) << ",\n";
+  out << "    \"timeout_s\": " << json_number(opts.timeout) << ",\n";
+  out << "    \"stabilize\": " << (opts.stabilize ? "true" : "false") << ",\n";
+  out << "    \"verify\": " << json_string(opts.verifyAll ? "all" : opts.verify ? "pass" : "off") << ",\n";
+  out << "    \"interference_threads\": " << list(levels) << ",\n";
+  out << "    \"interference_op\": " << json_string(stream_op_name(opts.interferenceOp)) << ",\n";
+  out << "    \"interference_pin\": " << json_string(opts.interferencePin) << ",\n";
+  out << "    \"memory_budget_bytes\": " << opts.memoryBudget << "\n";
+  out << "  },\n";
+
+  out << "  \"environment\": {\n";
+  for (const auto& item : r.env.items) out << "    " << json_string(json_key(item.first)) << ": "
+                                           << json_string(item.second) << ",\n";
+  std::vector<std::string> warnings;
+  for (const std::string& w : r.env.warnings) warnings.push_back(json_string(w));
+  out << "    \"warnings\": " << list(warnings) << "\n";
+  out << "  },\n";
+
+  out << "  \"noise_floor_s\": {";
+  const char* sep = "\n";
+  for (const auto& f : r.floors) {
+    out << sep << "    " << json_string(wait_mode_name(f.first)) << ": { \"marker\": " << json_number(f.second.marker)
+        << ", \"finish\": " << json_number(f.second.finish) << ", \"write_1b\": " << json_number(f.second.write1)
+        << ", \"read_1b\": " << json_number(f.second.read1) << " }";
+    sep = ",\n";
+  }
+  out << (r.floors.empty() ? "},\n" : "\n  },\n");
+
+  out << "  \"sizes\": [";
+  sep = "\n";
+  for (const ReportSize& z : r.results) {
+    out << sep << "    { \"size_bytes\": " << z.size << ", \"shared_buffer\": " << (z.shared ? "true" : "false")
+        << ", \"verify_checks\": " << z.verifyChecks << ", \"verify_failures\": "
+        << (z.verified ? std::to_string(z.verifyFailures) : "null")
+        << ", \"aer_correctable_delta\": " << (z.aerCorrectable < 0 ? "null" : std::to_string(z.aerCorrectable))
+        << ", \"link_changes\": " << z.linkChanges << " }";
+    sep = ",\n";
+  }
+  out << (r.results.empty() ? "],\n" : "\n  ],\n");
+
+  out << "  \"results\": [";
+  sep = "\n";
+  for (const ReportRow& row : r.rows) {
+    const Summary& s = row.s;
+    out << sep << "    {\n"
+        << "      \"size_bytes\": " << row.size << ", \"direction\": " << json_string(direction_name(row.direction))
+        << ", \"wait_mode\": " << json_string(wait_mode_name(row.mode)) << ", \"load_threads\": " << row.loadThreads
+        << ", \"samples\": " << row.samples << ",\n"
+        << "      \"bandwidth_bytes_per_s\": { \"avg\": " << json_number(row.size / s.avg)
+        << ", \"min\": " << json_number(row.size / s.max) << ", \"max\": " << json_number(row.size / s.min) << " },\n"
+        << "      \"latency_s\": { \"min\": " << json_number(s.min) << ", \"avg\": " << json_number(s.avg)
+        << ", \"p50\": " << json_number(s.p50) << ", \"p90\": " << json_number(s.p90)
+        << ", \"p99\": " << json_number(s.p99) << ", \"max\": " << json_number(s.max)
+        << ", \"device_p50\": " << (s.deviceP50 > 0 ? json_number(s.deviceP50) : "null") << " },\n"
+        << "      \"cpu_s_per_transfer\": " << json_number(s.cpuPerTransfer)
+        << ", \"thread_cpu_s_per_transfer\": " << json_number(s.threadCpuPerTransfer)
+        << ", \"cpu_s_per_gb\": " << json_number(s.cpuPerGB) << ",\n"
+        << "      \"context_switches_per_transfer\": { \"voluntary\": " << json_number(s.voluntaryPerTransfer)
+        << ", \"involuntary\": " << json_number(s.involuntaryPerTransfer) << " },\n"
+        << "      \"link_efficiency\": " << (row.linkEfficiency < 0 ? "null" : json_number(row.linkEfficiency))
+        << ", \"stalls\": " << row.stalls << ", \"change_points\": " << row.changePoints << ",\n"
+        << "      \"cv\": " << json_number(row.cv)
+        << ", \"baseline_cv\": " << (row.baselineCv < 0 ? "null" : json_number(row.baselineCv))
+        << ", \"host_load_bytes_per_s\": " << (row.hostBytesPerSec < 0 ? "null" : json_number(row.hostBytesPerSec))
+        << ",\n"
+        << "      \"minus_floor\": ";
+    if (row.floor > 0) {
+      out << "{ \"floor_s\": " << json_number(row.floor) << ", \"latency_p50_s\": " << json_number(s.p50 - row.floor)
+          << ", \"bandwidth_avg_bytes_per_s\": " << (s.avg > row.floor ? json_number(row.size / (s.avg - row.floor))
+                                                                        : "null") << " }";
+    } else {
+      out << "null";
+    }
+    out << ",\n      \"perf_per_transfer\": " << values(row.perf, r.perfEnabled) << ",\n"
+        << "      \"energy_j_per_gb\": " << values(row.energy, opts.energy) << ",\n"
+        << "      \"sensors\": ";
+    if (r.sensorsEnabled) {
+      out << "{";
+      const char* inner = " ";
+      for (const SensorRange& range : row.sensors) {
+        out << inner << json_string(json_key(range.label)) << ": { \"min\": " << json_number(range.min)
+            << ", \"avg\": " << json_number(range.avg) << ", \"max\": " << json_number(range.max)
+            << ", \"unit\": " << json_string(range.unit) << " }";
+        inner = ", ";
+      }
+      out << (row.sensors.empty() ? "}" : " }");
+    } else {
+      out << "null";
+    }
+    out << ",\n      \"periods\": ";
+    if (row.periodsChecked) {
+      std::vector<std::string> periods;
+      for (const Period& p : row.periods) {
+        periods.push_back("{ \"iterations\": " + json_number(p.iterations) + ", \"seconds\": " +
+                          json_number(p.seconds) + ", \"amplitude_s\": " + json_number(p.amplitude) +
+                          ", \"correlation\": " + json_number(p.correlation) + " }");
+      }
+      out << list(periods);
+    } else {
+      out << "null";
+    }
+    out << "\n    }";
+    sep = ",\n";
+  }
+  out << (r.rows.empty() ? "]\n" : "\n  ]\n");
+  out << "}\n";
+}
+
+std::string csv_field(const std::string& s) {
+  if (s.find_first_of(",\"\n") == std::string::npos) return s;
+  std::string out = "\"";
+  for (char c : s) out += c == '"' ? std::string("\"\"") : std::string(1, c);
+  return out + "\"";
+}
+
+// One row per size, direction, wait mode and load level, with the device
+// identity repeated so files from many hosts can be concatenated.
+// Variable sets (perf counters, energy sources, sensors, periods) are packed
+// into one field as name=value pairs separated by semicolons.
+void write_csv(std::ostream& out, const Report& r) {
+  out << "schema,cpu,gpu,pci,size_bytes,direction,wait_mode,load_threads,samples,"
+         "bw_avg_bytes_per_s,bw_min_bytes_per_s,bw_max_bytes_per_s,"
+         "lat_min_s,lat_avg_s,lat_p50_s,lat_p90_s,lat_p99_s,lat_max_s,device_p50_s,"
+         "cpu_s_per_transfer,thread_cpu_s_per_transfer,cpu_s_per_gb,voluntary_per_transfer,involuntary_per_transfer,"
+         "link_efficiency,stalls,change_points,verify_failures,aer_correctable_delta,"
+         "cv,baseline_cv,host_load_bytes_per_s,floor_s,minus_floor_p50_s,minus_floor_bw_avg_bytes_per_s,"
+         "perf_per_transfer,energy_j_per_gb,sensors_min_avg_max,periods_s\n";
+  auto num = [](double v) { return std::isfinite(v) ? json_number(v) : std::string(); };
+  auto pairs = [&](const std::vector<std::pair<std::string, double>>& items) {
+    std::string s;
+    for (const auto& item : items) s += (s.empty() ? "" : ";") + json_key(item.first) + "=" + num(item.second);
+    return csv_field(s);
+  };
+  for (const ReportRow& row : r.rows) {
+    const Summary& s = row.s;
+    const ReportSize* z = nullptr;
+    for (const ReportSize& candidate : r.results) {
+      if (candidate.size == row.size) z = &candidate;
+    }
+    out << reportSchema << "," << csv_field(r.cpu) << "," << csv_field(r.gpu) << "," << r.pci << ","
+        << row.size << "," << direction_name(row.direction) << "," << wait_mode_name(row.mode) << ","
+        << row.loadThreads << "," << row.samples << ","
+        << num(row.size / s.avg) << "," << num(row.size / s.max) << "," << num(row.size / s.min) << ","
+        << num(s.min) << "," << num(s.avg) << "," << num(s.p50) << "," << num(s.p90) << "," << num(s.p99) << ","
+        << num(s.max) << "," << (s.deviceP50 > 0 ? num(s.deviceP50) : "") << ","
+        << num(s.cpuPerTransfer) << "," << num(s.threadCpuPerTransfer) << "," << num(s.cpuPerGB) << ","
+        << num(s.voluntaryPerTransfer) << "," << num(s.involuntaryPerTransfer) << ","
+        << (row.linkEfficiency < 0 ? "" : num(row.linkEfficiency)) << "," << row.stalls << ","
+        << row.changePoints << "," << (z && z->verified ? std::to_string(z->verifyFailures) : "") << ","
+        << (z && z->aerCorrectable >= 0 ? std::to_string(z->aerCorrectable) : "") << ","
+        << num(row.cv) << "," << (row.baselineCv < 0 ? "" : num(row.baselineCv)) << ","
+        << (row.hostBytesPerSec < 0 ? "" : num(row.hostBytesPerSec)) << ",";
+    if (row.floor > 0) {
+      out << num(row.floor) << "," << num(s.p50 - row.floor) << ","
+          << (s.avg > row.floor ? num(row.size / (s.avg - row.floor)) : "") << ",";
+    } else {
+      out << ",,,";
+    }
+    std::string sensors, periods;
+    for (const SensorRange& range : row.sensors) {
+      sensors += (sensors.empty() ? "" : ";") + json_key(range.label) + "=" + num(range.min) + "/" + num(range.avg) +
+                 "/" + num(range.max);
+    }
+    for (const Period& p : row.periods) periods += (periods.empty() ? "" : ";") + num(p.seconds);
+    out << pairs(row.perf) << "," << pairs(row.energy) << "," << csv_field(sensors) << "," << csv_field(periods)
+        << "\n";
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options opts;
+  int targetDevice = 0;
+  bool userSpecifiedSizes = false;
+
+  std::vector<size_t> sizes = {
+    512 * 1024,
+    1 * 1024 * 1024,
+    10 * 1024 * 1024,
+    100 * 1024 * 1024,
+    512 * 1024 * 1024,
+  };
+
+#if UINTPTR_MAX == 0xffffffffffffffff
+  sizes.push_back(1024ULL * 1024 * 1024);   // 1 GB
+  sizes.push_back(2048ULL * 1024 * 1024);   // 2 GB
+  sizes.push_back(4096ULL * 1024 * 1024);   // 4 GB
+#endif
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--help") {
+      print_help();
+      return 0;
+    } else if (arg == "--version") {
+      std::cout << "gpu-pcie-bench version " << VERSION << "\n";
+      return 0;
+    } else if (arg == "--rounds" && i + 1 < argc) {
+      opts.rounds = std::stoi(argv[++i]);
+    } else if (arg == "--sizes" && i + 1 < argc) {
+      sizes = parse_sizes(argv[++i]);
+      userSpecifiedSizes = true;
+    } else if (arg == "--direction" && i + 1 < argc) {
+      opts.direction = parse_direction(argv[++i]);
+    } else if (arg == "--unit" && i + 1 < argc) {
+      opts.unit = parse_unit(argv[++i]);
+    } else if (arg == "--wait" && i + 1 < argc) {
+      opts.waitModes = parse_wait_modes(argv[++i]);
+    } else if (arg == "--perf") {
+      opts.perf = true;
+    } else if (arg == "--stall-factor" && i + 1 < argc) {
+      opts.stallFactor = std::stod(argv[++i]);
+    } else if (arg == "--periodicity") {
+      opts.periodicity = true;
+    } else if (arg == "--changepoints") {
+      opts.changePoints = true;
+    } else if (arg == "--sensors") {
+      opts.sensors = true;
+    } else if (arg == "--sensor-rate" && i + 1 < argc) {
+      opts.sensorRate = std::stod(argv[++i]);
+    } else if (arg == "--sysfs-root" && i + 1 < argc) {
+      opts.sysfsRoot = argv[++i];
+    } else if (arg == "--energy") {
+      opts.energy = true;
+      opts.sensors = true;
+    } else if (arg == "--pci-device" && i + 1 < argc) {
+      opts.pciDevice = argv[++i];
+    } else if (arg == "--duration" && i + 1 < argc) {
+      opts.duration = parse_duration(argv[++i]);
+    } else if (arg == "--timeout" && i + 1 < argc) {
+      opts.timeout = parse_duration(argv[++i]);
+    } else if (arg == "--clock" && i + 1 < argc) {
+      opts.clock = argv[++i];
+      bool known = opts.clock == "auto";
+      for (const char* name : clockShortNames) known |= opts.clock == name;
+      if (!known) {
+        std::cerr << "Unknown clock: " << opts.clock << "\n";
+        return 1;
+      }
+    } else if (arg == "--subtract-floor") {
+      opts.subtractFloor = true;
+    } else if (arg == "--pattern" && i + 1 < argc) {
+      opts.pattern = parse_pattern(argv[++i]);
+    } else if (arg == "--verify") {
+      opts.verify = true;
+    } else if (arg == "--verify-all") {
+      opts.verify = opts.verifyAll = true;
+    } else if (arg == "--alignment-sweep") {
+      opts.alignmentSweep = true;
+    } else if (arg == "--cpu-access") {
+      opts.cpuAccess = true;
+    } else if (arg == "--memory-budget" && i + 1 < argc) {
+      std::vector<size_t> budget = parse_sizes(argv[++i]);
+      if (budget.size() != 1 || budget.front() == 0) {
+        std::cerr << "Invalid memory budget: " << argv[i] << "\n";
+        return 1;
+      }
+      opts.memoryBudget = budget.front();
+    } else if (arg == "--interference" && i + 1 < argc) {
+      std::stringstream ss(argv[++i]);
+      std::string item;
+      while (std::getline(ss, item, ',')) opts.interference.push_back(std::max(0, std::stoi(item)));
+    } else if (arg == "--interference-op" && i + 1 < argc) {
+      opts.interferenceOp = parse_stream_op(argv[++i]);
+    } else if (arg == "--interference-pin" && i + 1 < argc) {
+      opts.interferencePin = argv[++i];
+      if (opts.interferencePin != "none" && opts.interferencePin != "numa" && opts.interferencePin != "smt") {
+        std::cerr << "Unknown interference pinning: " << opts.interferencePin << "\n";
+        return 1;
+      }
+    } else if (arg == "--stabilize") {
+      opts.stabilize = true;
+    } else if (arg == "--format" && i + 1 < argc) {
+      opts.format = argv[++i];
+      if (opts.format != "text" && opts.format != "json" && opts.format != "csv") {
+        std::cerr << "Unknown format: " << opts.format << "\n";
+        return 1;
+      }
+    } else if (arg == "--output" && i + 1 < argc) {
+      opts.output = argv[++i];
+    } else if (arg == "--samples" && i + 1 < argc) {
+      opts.samples = argv[++i];
+    } else if (arg == "--samples-to-csv" && i + 1 < argc) {
+      opts.samplesToCsv = argv[++i];
+    } else if (arg == "--trace" && i + 1 < argc) {
+      opts.trace = argv[++i];
+      tracer.enabled = true;
+    } else if (arg == "--strict") {
+      opts.strict = true;
+    } else if (arg == "--topology") {
+      opts.topology = true;
+    } else if (arg == "--devices" && i + 1 < argc) {
+      opts.devices = argv[++i];
+      opts.topology = true;
+    } else if (arg == "--device" && i + 1 < argc) {
+      targetDevice = std::stoi(argv[++i]);
+    } else {
+      std::cerr << "Unknown argument: " << arg << "\n";
+      print_help();
+      return 1;
+    }
+  }
+
+  if (opts.format != "text" && (opts.duration > 0 || !opts.devices.empty() || opts.alignmentSweep || opts.cpuAccess)) {
+    std::cerr << "--format " << opts.format << " summarizes the size loop and cannot be combined with --duration, "
+              << "--devices, --alignment-sweep or --cpu-access\n";
+    return 1;
+  }
+
+  // Text goes to --output or stdout; with json or csv on stdout it moves to
+  // stderr so the summary can be piped. The file is never closed because
+  // std::cout may write to it until exit.
+  std::streambuf* stdoutBuf = std::cout.rdbuf();
+  std::ofstream* outputFile = nullptr;
+  if (!opts.output.empty()) {
+    outputFile = new std::ofstream(opts.output);
+    if (!*outputFile) {
+      std::cerr << "Cannot open output file " << opts.output << "\n";
+      return 1;
+    }
+  }
+  if (opts.format == "text" && outputFile) std::cout.rdbuf(outputFile->rdbuf());
+  else if (opts.format != "text" && !outputFile) std::cout.rdbuf(std::cerr.rdbuf());
+  Report report;
+
+  if (!opts.samplesToCsv.empty()) {
+    std::ostream out(outputFile ? outputFile->rdbuf() : stdoutBuf);
+    return samples_to_csv(opts.samplesToCsv, out);
+  }
+
+  elapsed_seconds();  // start the sample clock
+
+  // CPU Name
+  report.cpu = get_cpu_name();
+  std::cout << "CPU: " << report.cpu << "\n";
+
+  cl_int status;
+  cl_uint numPlatforms = 0;
+  CHECK(clGetPlatformIDs(0, nullptr, &numPlatforms), "Failed to get platform count");
+  if (numPlatforms == 0) {
+    std::cerr << "No OpenCL platforms found.\n";
+    return 1;
+  }
+  std::vector<cl_platform_id> platforms(numPlatforms);
+  CHECK(clGetPlatformIDs(numPlatforms, platforms.data(), nullptr), "Failed to get platforms");
+
+  cl_platform_id platform = platforms[0];
+  cl_uint numDevices = 0;
+  CHECK(clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 0, nullptr, &numDevices), "Failed to get device count");
+  if (numDevices == 0) {
+    std::cerr << "No GPU devices found on platform.\n";
+    return 1;
+  }
+  std::vector<cl_device_id> devices(numDevices);
+  CHECK(clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, numDevices, devices.data(), nullptr), "Failed to get devices");
+
+  if (targetDevice >= numDevices) {
+    std::cerr << "Target GPU device " << targetDevice << " is beyond GPU devices found on platform.\n";
+    return 1;
+  }
+
+  cl_device_id device = devices[targetDevice];
+
+  // GPU Name
+  size_t gpuNameSize = 0;
+  CHECK(clGetDeviceInfo(device, CL_DEVICE_NAME, 0, nullptr, &gpuNameSize), "Failed to get GPU name size");
+  std::vector<char> gpuName(gpuNameSize);
+  CHECK(clGetDeviceInfo(device, CL_DEVICE_NAME, gpuNameSize, gpuName.data(), nullptr), "Failed to get GPU name");
+
+  cl_ulong gpuMemSize = 0;
+  CHECK(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(gpuMemSize), &gpuMemSize, nullptr), "Failed to get GPU memory size");
+
+  std::cout << "GPU: " << std::string(gpuName.data()) << " (" << (gpuMemSize / (1024 * 1024)) << " MB)\n";
+
+  std::string pciAddress = opts.pciDevice.empty() ? get_pci_address(device, opts.sysfsRoot, targetDevice)
+                                                  : opts.pciDevice;
+  if (!pciAddress.empty()) std::cout << "PCI: " << pciAddress << "\n";
+  report.gpu = gpuName.data();
+  report.gpuMemory = gpuMemSize;
+  report.pci = pciAddress;
+
+  std::cout << std::fixed << std::setprecision(2);
+
+  Environment env = collect_environment(platform, device, opts.sysfsRoot, pciAddress);
+  std::cout << "\n";
+  print_environment(env);
+  report.env = env;
+  print_clock_calibration(calibrate_clocks(opts.clock));
+  if (opts.strict && !env.warnings.empty()) {
+    std::cerr << "Refusing to benchmark in --strict mode: " << env.warnings.size() << " environment warning(s).\n";
+    return 1;
+  }
+
+  if (opts.topology) {
+    PciTopology topo;
+    std::vector<std::string> names;
+    for (cl_uint i = 0; i < numDevices; ++i) {
+      names.push_back(get_device_name(devices[i]));
+      topo.add(opts.sysfsRoot, i == static_cast<cl_uint>(targetDevice) ? pciAddress
+                                   : get_pci_address(devices[i], opts.sysfsRoot, i), i);
+    }
+    topo.find_shared_uplinks();
+    std::cout << "\n";
+    print_topology(topo, names, opts.unit);
+
+    if (!opts.devices.empty()) {
+      std::vector<int> selected;
+      if (opts.devices == "all") {
+        for (cl_uint i = 0; i < numDevices; ++i) selected.push_back(i);
+      } else {
+        std::stringstream ss(opts.devices);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+          int index = std::stoi(item);
+          if (index < 0 || index >= static_cast<int>(numDevices)) {
+            std::cerr << "Device " << index << " is beyond GPU devices found on platform.\n";
+            return 1;
+          }
+          if (std::find(selected.begin(), selected.end(), index) != selected.end()) {
+            std::cerr << "Device " << index << " is listed twice in --devices.\n";
+            return 1;
+          }
+          selected.push_back(index);
+        }
+      }
+      if (selected.size() < 2) {
+        std::cerr << "--devices needs at least two GPUs.\n";
+        return 1;
+      }
+      size_t dataSize = userSpecifiedSizes && !sizes.empty() ? sizes.front() : 64 * 1024 * 1024;
+      int failed = run_contention(devices, selected, topo, dataSize, opts);
+      if (!opts.trace.empty() && !tracer.write(opts.trace)) return 1;
+      return failed;
+    }
+  }
+
+  if (opts.duration > 0) {
+    // Soak mode runs a single size
+    sizes.resize(userSpecifiedSizes && !sizes.empty() ? 1 : 0);
+    if (sizes.empty()) sizes.push_back(64 * 1024 * 1024);
+    if (opts.timeout <= 0) opts.timeout = 10;
+  } else if (!userSpecifiedSizes) {
+    filter_static_sizes_by_gpu_memory(sizes, static_cast<size_t>(gpuMemSize));
+  }
+
+  // The alignment sweep and CPU access measurement replace the size loop
+  bool sizeLoop = !opts.alignmentSweep && !opts.cpuAccess;
+  HostMemory hostMemory = read_host_memory(opts.sysfsRoot);
+  MemoryPlan memoryPlan;
+  if (sizeLoop) {
+    memoryPlan = plan_memory(sizes, opts, hostMemory);
+    print_memory_plan(memoryPlan, hostMemory, opts);
+  }
+  MemoryUsage memoryUsage;
+
+  if (sizes.empty()) {
+    std::cerr << "No buffer sizes fit GPU or host memory constraints. Exiting.\n";
+    return 1;
+  }
+
+  cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &status);
+  CHECK(status, "Failed to create context");
+
+  cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &status);
+  CHECK(status, "Failed to create command queue");
+
+  Instruments inst;
+  if (opts.perf) inst.perf.open();
+  inst.watchdog.start(opts.timeout);
+  if (opts.sensors) inst.sensors.start(opts.sysfsRoot, opts.sensorRate);
+  if (opts.energy) inst.energy.open(opts.sysfsRoot);
+  inst.link.open(opts.sysfsRoot, pciAddress);
+  if (!opts.samples.empty() && !inst.samples.open(opts.samples)) return 1;
+  Stabilizer stabilizer;
+  inst.verify.everyTransfer = opts.verifyAll;
+  bool verifyFailed = false;
+
+  // Only the size loop prints or subtracts the floor
+  std::map<WaitMode, NoiseFloor> floors;
+  if (sizeLoop && opts.duration <= 0) {
+    for (WaitMode mode : opts.waitModes) {
+      if (measure_noise_floor(context, queue, mode, floors[mode])) return 1;
+    }
+    print_noise_floor(opts.waitModes, floors);
+    report.floors = floors;
+  }
+
+  MemoryInterference interference;
+  std::string pinning;
+  std::vector<int> loadLevels = opts.interference;  // background threads per pass, 0 = none
+  if (loadLevels.empty()) loadLevels.push_back(0);
+  std::vector<std::vector<int>> cpuSets;
+  if (!opts.interference.empty()) {
+    cpuSets = interference_cpu_sets(opts.interferencePin, opts.sysfsRoot, pciAddress, pinning,
+                                    interference.submitterCpu);
+  }
+  print_link_budget(inst.link.budget, opts.unit);
+  report.link = inst.link.budget;
+  report.sizes = sizes;
+
+  if (opts.alignmentSweep) {
+    std::vector<size_t> sweepSizes = userSpecifiedSizes ? sizes : std::vector<size_t>{ 4096, 1024 * 1024,
+                                                                                        64 * 1024 * 1024 };
+    if (run_alignment_sweep(context, queue, sweepSizes, opts)) return 1;
+  }
+  if (opts.cpuAccess) {
+    if (run_cpu_access(context, queue, userSpecifiedSizes ? sizes.front() : 64 * 1024 * 1024, opts)) return 1;
+  }
+
+  if (sizeLoop) {
+    for (size_t dataSize : sizes) {
+      std::cout << "\n[Buffer size: " << format_size(dataSize) << "]\n";
+
+      cl_mem hostBuf = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, dataSize, nullptr, &status);
+      CHECK(status, "Failed to allocate pinned host buffer");
+
+      // With a shared buffer, reads land in the send buffer
+      bool shared = memoryPlan.is_shared(dataSize);
+      cl_mem recvBuf = nullptr;
+      if (!shared) {
+        recvBuf = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, dataSize, nullptr, &status);
+        CHECK(status, "Failed to allocate pinned receive buffer");
+      }
+
+      cl_map_flags mapFlags = shared ? CL_MAP_READ | CL_MAP_WRITE : CL_MAP_WRITE;
+      void* hostPtr = clEnqueueMapBuffer(queue, hostBuf, CL_TRUE, mapFlags, 0, dataSize, 0, nullptr, nullptr, &status);
+      CHECK(status, "Failed to map host buffer");
+
+      void* recvPtr = hostPtr;
+      if (!shared) {
+        recvPtr = clEnqueueMapBuffer(queue, recvBuf, CL_TRUE, CL_MAP_READ, 0, dataSize, 0, nullptr, nullptr, &status);
+        CHECK(status, "Failed to map recv buffer");
+      }
+
+      auto fillStart = std::chrono::steady_clock::now();
+      fill_pattern(hostPtr, dataSize, opts.pattern);
+      double fillSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - fillStart).count();
+
+      cl_mem deviceBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, dataSize, nullptr, &status);
+      CHECK(status, "Failed to allocate device buffer");
+      CHECK(clEnqueueWriteBuffer(queue, deviceBuffer, CL_TRUE, 0, dataSize, hostPtr, 0, nullptr, nullptr),
+            "Failed to initialize device buffer");
+      std::cout << "Pattern: " << pattern_name(opts.pattern) << " (host filled in " << fillSeconds * 1e3
+                << " ms, device initialized)\n";
+      memoryUsage.sample(shared ? dataSize : 2 * static_cast<uint64_t>(dataSize));
+
+      // Verification needs a receive buffer separate from the reference
+      inst.verify.enabled = opts.verify && !shared;
+      if (opts.verify && shared) std::cout << "Verify: skipped, receive buffer shared to fit the memory budget\n";
+      inst.verify.prepare(hostPtr, dataSize);
+
+      inst.link.begin();
+
+      if (opts.duration > 0) {
+        if (!opts.interference.empty()) interference.start(opts.interference.front(), opts.interferenceOp, cpuSets);
+        if (opts.stabilize) stabilizer.apply(opts.sysfsRoot);
+        int failed = run_soak(queue, deviceBuffer, hostPtr, recvPtr, dataSize, opts, inst);
+        stabilizer.revert();
+        interference.stop();
+        if (failed) return 1;
+        if (verify_pass(queue, deviceBuffer, hostPtr, recvPtr, dataSize, opts, "soak", inst.verify)) return 1;
+      } else {
+        std::vector<LoadLevel> levels;
+        for (int threads : loadLevels) {
+          if (!opts.interference.empty()) {
+            std::cout << "Background memory load: " << threads << " threads\n";
+            interference.start(threads, opts.interferenceOp, cpuSets);
+          }
+          inst.samples.load = static_cast<uint64_t>(threads);
+
+          std::vector<PassResult> passes;
+          for (WaitMode mode : opts.waitModes) {
+            if (opts.waitModes.size() > 1) std::cout << "Wait mode: " << wait_mode_name(mode) << "\n";
+            PassResult baseline, pass;
+            if (opts.stabilize) {
+              Options plain = opts;
+              plain.stabilize = false;
+              std::cout << "Baseline without stabilization:\n";
+              inst.samples.baseline = true;
+              if (run_pass(queue, deviceBuffer, hostPtr, recvPtr, dataSize, plain, mode, inst, baseline)) return 1;
+              inst.samples.baseline = false;
+              stabilizer.apply(opts.sysfsRoot);
+              std::cout << "Stabilized:\n";
+            }
+            int failed = run_pass(queue, deviceBuffer, hostPtr, recvPtr, dataSize, opts, mode, inst, pass);
+            stabilizer.revert();
+            if (failed) return 1;
+            pass.floor = floors[mode];
+            if (verify_pass(queue, deviceBuffer, hostPtr, recvPtr, dataSize, opts, wait_mode_name(mode), inst.verify)) {
+              return 1;
+            }
+            print_pass(pass, dataSize, opts, inst);
+            report.add_pass(pass, opts.stabilize ? &baseline : nullptr, dataSize, threads, opts, inst);
+            if (opts.stabilize) print_stabilization(stabilizer, baseline, pass, dataSize, opts);
+            passes.push_back(std::move(pass));
+          }
+
+          if (passes.size() > 1) print_wait_comparison(passes, dataSize, opts);
+
+          LoadLevel level;
+          level.threads = threads;
+          level.hostBytesPerSec = interference.stop();
+          if (!opts.interference.empty()) report.set_host_load(dataSize, threads, level.hostBytesPerSec);
+          if (!passes.empty()) level.pass = std::move(passes.front());
+          levels.push_back(std::move(level));
+        }
+
+        if (levels.size() > 1) print_interference(levels, dataSize, opts, pinning);
+      }
+
+      print_verify(inst.verify);
+      verifyFailed |= inst.verify.failureCount > 0;
+
+      inst.link.end();
+      print_link_health(inst.link);
+
+      ReportSize result;
+      result.size = dataSize;
+      result.shared = shared;
+      result.verified = inst.verify.enabled;
+      result.verifyChecks = inst.verify.checks;
+      result.verifyFailures = inst.verify.failureCount;
+      result.aerCorrectable = inst.link.enabled() ? inst.link.correctable_delta() : -1;
+      result.linkChanges = inst.link.changes.size();
+      report.results.push_back(result);
+
+      clEnqueueUnmapMemObject(queue, hostBuf, hostPtr, 0, nullptr, nullptr);
+      if (recvBuf) clEnqueueUnmapMemObject(queue, recvBuf, recvPtr, 0, nullptr, nullptr);
+
+      clReleaseMemObject(hostBuf);
+      if (recvBuf) clReleaseMemObject(recvBuf);
+      clReleaseMemObject(deviceBuffer);
+    }
+
+    memoryUsage.sample(0);
+    print_memory_usage(memoryUsage);
+  }
+
+  if (!opts.trace.empty() && !tracer.write(opts.trace)) return 1;
+
+  if (opts.format != "text") {
+    std::ostream out(outputFile ? outputFile->rdbuf() : stdoutBuf);
+    if (opts.format == "json") write_json(out, report, opts);
+    else write_csv(out, report);
+    out.flush();
+  }
+
+#ifdef _WIN32
+  std::cout << "\nPress Enter to exit...";
+  std::cin.get();
+#endif
+
+  inst.samples.close();
+  inst.energy.close();
+  inst.sensors.stop();
+  inst.watchdog.stop();
+  inst.perf.close();
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  return verifyFailed ? 3 : 0;
 }